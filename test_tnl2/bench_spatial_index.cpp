@@ -0,0 +1,118 @@
+// Copyright GarageGames.  See /license/info.txt in this distribution for licensing terms.
+
+/// bench_spatial_index times the scope queries of 1,000 connections over 10,000 objects, first by testing the distance to every object, the way a perform_scope_query() without an index works, and then with spatial_index::scope_radius().  It also times moving every object and checks that both queries scope the same objects.  net_object and ghost_connection are stood in for by the few members spatial_index uses, so the benchmark measures the index alone.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "core/platform.h"
+
+namespace core
+{
+	#include "core/core.h"
+
+	struct bench
+	{
+		class spatial_index;
+
+		class net_object
+		{
+			friend class spatial_index;
+			spatial_index *_spatial_index;
+			int32 _spatial_index_entry;
+		public:
+			float32 x, y;
+			net_object() { _spatial_index = NULL; _spatial_index_entry = 0; x = y = 0; }
+		};
+
+		class ghost_connection
+		{
+		public:
+			uint32 scoped_count; ///< Number of object_in_scope() calls.
+			ghost_connection() { scoped_count = 0; }
+			void object_in_scope(net_object *) { scoped_count++; }
+		};
+
+		#include "spatial_index.h"
+	};
+};
+using namespace core;
+
+enum {
+	object_count = 10000,
+	connection_count = 1000,
+};
+static const float32 scope_radius = 0.05f;
+
+static float32 random_unit_float()
+{
+	return rand() / float32(RAND_MAX);
+}
+
+static double get_elapsed_milliseconds(clock_t start)
+{
+	return (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+}
+
+int main()
+{
+	static bench::net_object objects[object_count];
+	bench::spatial_index index(scope_radius);
+
+	srand(1);
+	for(uint32 i = 0; i < object_count; i++)
+	{
+		objects[i].x = random_unit_float();
+		objects[i].y = random_unit_float();
+		index.add_object(&objects[i], objects[i].x, objects[i].y);
+	}
+
+	// each connection scopes around one of the objects
+	bench::ghost_connection linear_connection, index_connection;
+	float32 radius_squared = scope_radius * scope_radius;
+	clock_t start = clock();
+	for(uint32 c = 0; c < connection_count; c++)
+	{
+		bench::net_object &scope_object = objects[c * (object_count / connection_count)];
+		for(uint32 i = 0; i < object_count; i++)
+		{
+			float32 dx = objects[i].x - scope_object.x;
+			float32 dy = objects[i].y - scope_object.y;
+			if(dx * dx + dy * dy < radius_squared)
+				linear_connection.object_in_scope(&objects[i]);
+		}
+	}
+	double linear_time = get_elapsed_milliseconds(start);
+
+	start = clock();
+	for(uint32 c = 0; c < connection_count; c++)
+	{
+		bench::net_object &scope_object = objects[c * (object_count / connection_count)];
+		index.scope_radius(&index_connection, scope_object.x, scope_object.y, scope_radius);
+	}
+	double index_time = get_elapsed_milliseconds(start);
+
+	start = clock();
+	for(uint32 i = 0; i < object_count; i++)
+	{
+		objects[i].x += (random_unit_float() - 0.5f) * 0.01f;
+		objects[i].y += (random_unit_float() - 0.5f) * 0.01f;
+		index.update_object(&objects[i], objects[i].x, objects[i].y);
+	}
+	double update_time = get_elapsed_milliseconds(start);
+
+	printf("%d objects, %d connections, radius %g\n", object_count, connection_count, scope_radius);
+	printf("every object:  %8.2f ms, %u objects scoped\n", linear_time, linear_connection.scoped_count);
+	printf("spatial_index: %8.2f ms, %u objects scoped\n", index_time, index_connection.scoped_count);
+	printf("moving every object: %.3f ms\n", update_time);
+
+	for(uint32 i = 0; i < object_count; i++)
+		index.remove_object(&objects[i]);
+
+	if(linear_connection.scoped_count != index_connection.scoped_count)
+	{
+		printf("spatial_index scoped a different number of objects\n");
+		return 1;
+	}
+	return 0;
+}
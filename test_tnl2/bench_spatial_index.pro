@@ -0,0 +1,13 @@
+# -------------------------------------------------
+# spatial_index benchmark: scope queries for 10,000 objects and 1,000 connections
+# -------------------------------------------------
+CONFIG += console
+CONFIG -= qt app_bundle
+TARGET = bench_spatial_index
+TEMPLATE = app
+SOURCES += bench_spatial_index.cpp
+HEADERS += ../tnl2/spatial_index.h \
+    ../../torque_sockets/core/core.h \
+    ../../torque_sockets/core/array.h
+INCLUDEPATH += ../tnl2/ \
+	../../torque_sockets/
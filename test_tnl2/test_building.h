@@ -66,6 +66,7 @@ public:
 	{
 		// add it to the list of buildings in the game
 		the_game->_buildings.push_back(this);
+		the_game->_always_scoped_node->add_object(this);
 		_game = the_game;
 	}
 	
@@ -37,6 +37,7 @@ public:
 	{
 		register_rpc(&test_connection::rpc_set_control_object, rpc_guaranteed_ordered, rpc_host_to_initiator);
 		register_rpc(&test_connection::rpc_move_my_player_to, rpc_guaranteed_ordered, rpc_initiator_to_host);
+		register_object_rpc(&player::rpc_player_did_move, rpc_unguaranteed, rpc_host_to_initiator);
 	}
 	
 	/// The player object associated with this connection.
@@ -94,6 +95,9 @@ public:
 			_player = new player;
 			_player->add_to_game(((test_net_interface *) get_interface())->_game);
 			set_scope_object(_player);
+			// other players move too, so rescope a few times a second even if this one doesn't move
+			set_scope_query_period(250);
+			set_scope_query_movement_threshold(0.02f);
 			set_ghost_from(true);
 			set_ghost_to(false);
 			activate_ghosting();
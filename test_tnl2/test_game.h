@@ -4,6 +4,9 @@ class test_game {
 public:
 	array<player *> _players; ///< vector of player objects in the game
 	array<building *> _buildings; ///< vector of _buildings in the game
+	spatial_index _player_index; ///< grid of the players in the game, for scope queries
+	replication_graph _replication_graph; ///< nodes of objects scoped by the players
+	ref_ptr<replication_list_node> _always_scoped_node; ///< node of the objects every client always has in scope
 	bool _is_server; ///< was this game created to be a server?
 	test_net_interface *_net_interface; ///< network interface for this game
 	net::time _last_time; ///< last time that tick() was called
@@ -38,6 +41,10 @@ public:
 		
 		player::register_class(_type_database);
 		building::register_class(_type_database);
+		
+		_always_scoped_node = new replication_list_node;
+		_replication_graph.add_global_node(_always_scoped_node);
+		_replication_graph.add_global_node(new replication_grid_node(&_player_index));
 
 		_last_time = net::time::get_current();
 		
@@ -86,6 +93,7 @@ public:
 			return;
 		
 		float32 time_delta = (current_time - _last_time).get_milliseconds() / 1000.0f;
+		_replication_graph.begin_tick();
 		for(int32 i = 0; i < _players.size(); i++)  
 			_players[i]->update(time_delta, &_random);
 		_net_interface->tick();
@@ -11,6 +11,7 @@ public:
 	float32 _t; ///< Parameter of how far the player is along the line from _start_pos to _end_pos.
 	float32 _t_delta; ///< Change in _t per second (ie, velocity).
 	test_game *_game; ///< The _game object this player is associated with
+	replication_view _view; ///< What the client controlling this player sees, if this is its scope object.
 	
 	/// Enumeration of possible player types in the game.
 	enum player_type {
@@ -72,33 +73,37 @@ public:
 		position_state = 2, ///< This mask bit is set when the position information changes on the server.
 	};
 	
-	/// perform_scope_query is called to determine which objects are "in scope" for the client that controls this player instance.  In the TNLTest program, all objects in a circle of radius 0.25 around the scope object are considered to be in scope.
+	/// perform_scope_query is called to determine which objects are "in scope" for the client that controls this player instance.  In the TNLTest program, all objects in the grid cells within 0.25 of the scope object are considered to be in scope.
 	void perform_scope_query(ghost_connection *connection)
 	{
-		// find all the objects that are "in scope" - for the purposes of this test program, all buildings are considered to be in scope always, as well as all "players" in a circle of radius 0.25 around the scope object, or a radius squared of 0.0625
+		// find all the objects that are "in scope" - for the purposes of this test program, all buildings are considered to be in scope always, as well as all "players" in the grid cells within 0.25 of the scope object.  The game's replication graph has a node for the buildings and a grid node for the players.
 		
-		for(int32 i = 0; i < _game->_buildings.size(); i++)
-			connection->object_in_scope(_game->_buildings[i]);
-		
-		for(int32 i = 0; i < _game->_players.size(); i++)
-		{
-			position player_position = _game->_players[i]->_render_pos;
-			float32 dx = player_position.x - _render_pos.x;
-			float32 dy = player_position.y - _render_pos.y;
-			float32 dist_squared = dx * dx + dy * dy;
-			if(dist_squared < 0.0625)
-				connection->object_in_scope(_game->_players[i]);
-		}
+		_view.x = _render_pos.x;
+		_view.y = _render_pos.y;
+		_view.radius = 0.25f;
+		_game->_replication_graph.scope(connection, _view);
+	}
+
+	/// get_scope_position lets connections that this player scopes skip the scope query until it has moved a little.
+	bool get_scope_position(float32 &x, float32 &y)
+	{
+		x = _render_pos.x;
+		y = _render_pos.y;
+		return true;
 	}
 
 	static void register_class(type_database &the_database)
 	{
 		tnl_begin_class(the_database, player, net_object, true);
-		tnl_compound_slot(the_database, player, _start_pos, position_state);
-		tnl_compound_slot(the_database, player, _end_pos, position_state);
 		tnl_slot(the_database, player, _t, position_state);
 		tnl_slot(the_database, player, _t_delta, position_state);
 		tnl_end_class(the_database);
+		
+		// a player's path usually starts where the last one ended, near where it was, so the positions are sent as deltas
+		tnl_delta_slot(player, _start_pos.x, position_state);
+		tnl_delta_slot(player, _start_pos.y, position_state);
+		tnl_delta_slot(player, _end_pos.x, position_state);
+		tnl_delta_slot(player, _end_pos.y, position_state);
 	}
 	
 	/// server_set_position is called on the server when it receives notice from a client to change the position of the player it controls.  server_set_position will call setMaskBits(PositionMask) to notify the network system that this object has changed state.
@@ -113,10 +118,10 @@ public:
 		// notify the network system that the position state of this object has changed:
 		set_dirty_state(position_state);
 		
-		// // call a quick RPC to all the connections that have this object in scope
-		//rpcPlayerDidMove(end_pos.x, end_pos.y);
+		// call a quick RPC to all the connections that have this object in scope
+		ghost_rpc(&player::rpc_player_did_move, unit_float<6>(end_pos.x), unit_float<6>(end_pos.y));
 	}
-	void on_ghost_update(core::uint32 mask_bits)
+	void on_ghost_update(net_state_mask mask_bits)
 	{
 		logprintf("Got ghost update (%g, %g)->(%g, %g), %g, %g", float(_start_pos.x), float(_start_pos.y), float(_end_pos.x), float(_end_pos.y), _t, _t_delta);
 		update(0, 0);
@@ -146,6 +151,9 @@ public:
 		}
 		_render_pos.x = _start_pos.x + (_end_pos.x - _start_pos.x) * _t;
 		_render_pos.y = _start_pos.y + (_end_pos.y - _start_pos.y) * _t;
+		if(_game)
+			_game->_player_index.update_object(this, _render_pos.x, _render_pos.y);
+		set_priority_position(_render_pos.x, _render_pos.y);
 	}
 	
 	/// on_ghost_available is called on the server when it knows that this player has been constructed on the specified client as a result of being "in scope".  In TNLTest this method call is used to test the per-ghost targeted RPC functionality of NetObject subclasses by calling rpcPlayerIsInScope on the player ghost on the specified connection.
@@ -155,7 +163,7 @@ public:
 		{
 			// once the scope object is successfully ghosted to the client, send and rpc with the ghost index to that connection, so it knows which player it controls.
 			//rpc(&ghost_connection::rpc_end_ghosting);
-			the_connection->rpc(&test_connection::rpc_set_control_object, enumeration<1024>(the_connection->get_ghost_index(this)));
+			the_connection->rpc(&test_connection::rpc_set_control_object, enumeration<ghost_connection::max_ghost_count>(the_connection->get_ghost_index(this)));
 
 		}
 		// this function is called every time a ghost of this object is known to be available on a given client. we'll use this to demonstrate targeting a NetObject RPC to a specific connection.  Normally a RPC method marked as RPCToGhost will be broadcast to ALL ghosts of the object currently in scope.
@@ -179,6 +187,7 @@ public:
 	{
 		// add the player to the list of players in the _game.
 		the_game->_players.push_back(this);
+		the_game->_player_index.add_object(this, _render_pos.x, _render_pos.y);
 		_game = the_game;
 		
 		if(_player_type == player_type_my_client)
@@ -188,6 +197,12 @@ public:
 		}
 	}
 	
+	/// rpc_player_did_move is used in the test program to demonstrate a broadcast RPC from the server to all of the ghosts on clients scoping this object.  It also demonstrates the usage of the unit_float<> template argument, in this case using 6 bits for each x and y position.  unit_float arguments to RPCs are between 0 and 1.
+	void rpc_player_did_move(unit_float<6> x, unit_float<6> y)
+	{
+		logprintf("A player moved to %g, %g", float32(x), float32(y));
+	}
+	
 	/*
 	/// rpcPlayerWillMove is used in TNLTest to demonstrate ghost->parent NetObject RPCs.
 	TNL_DECLARE_RPC(rpcPlayerWillMove,  (TNL::StringPtr testString))
@@ -195,13 +210,6 @@ public:
 		TNL::logprintf("Expecting a player move from the connection: %s", testString.getString());
 	}
 	
-	/// rpcPlayerDidMove is used in TNLTest to demostrate a broadcast RPC from the server to all of the ghosts on clients scoping this object.  It also demonstrates the usage of the Float<> template argument, in this case using 6 bits for each X and Y position.  Float arguments to RPCs are between 0 and 1.
-	TNL_DECLARE_RPC(rpcPlayerDidMove,   (TNL::Float<6> x, TNL::Float<6> y))
-	{
-		float32 fx = x, fy = y;
-		TNL::logprintf("A player moved to %g, %g", fx, fy);
-	}
-	
 	/// rpcPlayerIsInScope is the RPC method called by on_ghost_available to demonstrate targeted NetObject RPCs.  on_ghost_available uses the TNL_RPC_CONSTRUCT_NETEVENT macro to construct a NetEvent from the RPC invocation and then posts it only to the client for which the object just came into scope.
 	TNL_DECLARE_RPC(rpcPlayerIsInScope, (TNL::Float<6> x, TNL::Float<6> y))
 	{
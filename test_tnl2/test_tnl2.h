@@ -4,6 +4,9 @@
 #include <iostream>
 #include "tomcrypt.h"
 #include "core/platform.h"
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h> // for ghost_connection::compute_distance_priorities()
+#endif
 #include "torque_sockets/torque_sockets_c_api.h"
 
 namespace core
@@ -20,6 +20,12 @@ HEADERS += tnl2_test_widget.h \
     ../tnl2/net_connection.h \
     ../tnl2/ghost_connection.h \
     ../tnl2/exceptions.h \
+    ../tnl2/rpc_functor.h \
+    ../tnl2/string_table.h \
+    ../tnl2/delta_slot.h \
+    ../tnl2/field_table.h \
+    ../tnl2/spatial_index.h \
+    ../tnl2/replication_graph.h \
     ../tnl2/event_connection.h \
     window.h \
     ../../torque_sockets/core/zone_allocator.h \
@@ -0,0 +1,279 @@
+/// Delta slots are ghosted fields that are sent as the difference from a value the remote host is known to have, rather than in full.
+///
+/// A delta slot is registered for a field of a net_object class in place of a type_database slot, with the tnl_delta_slot macro:
+///
+/// @code
+///    static void register_class(type_database &the_database)
+///    {
+///       tnl_begin_class(the_database, player, net_object, true);
+///       tnl_slot(the_database, player, _t, position_state);
+///       tnl_end_class(the_database);
+///       tnl_delta_slot(player, _end_pos.x, position_state);
+///       tnl_delta_slot(player, _end_pos.y, position_state);
+///    }
+/// @endcode
+///
+/// The state_index must also be used by a type_database slot of the class, so that it is included in the update masks the connection writes.  The field's value is quantized to an integer by delta_traits.  Each update of a ghost that writes delta slots is tagged with one of delta_tag_count tags, and both sides of the connection remember the values each tag carried.  Once the packet carrying a tag is acknowledged, later updates can send a slot as a zigzag, variable length difference from the value under that tag; until then, or when the difference wouldn't be smaller, the value is sent in full.  A dropped packet leaves its tag unacknowledged, so deltas are always from a value the remote host has received.
+///
+/// delta_traits is defined for int32, uint32 and unit_float; specialize it to add other quantized types.
+template <class T, class dummy = int> struct delta_traits
+{
+};
+
+template <class dummy> struct delta_traits<int32, dummy>
+{
+	enum { bit_count = 32 };
+	static uint32 get(void *field) { return uint32(*((int32 *) field)); }
+	static void set(void *field, uint32 value) { *((int32 *) field) = int32(value); }
+};
+
+template <class dummy> struct delta_traits<uint32, dummy>
+{
+	enum { bit_count = 32 };
+	static uint32 get(void *field) { return *((uint32 *) field); }
+	static void set(void *field, uint32 value) { *((uint32 *) field) = value; }
+};
+
+template <uint32 bits, class dummy> struct delta_traits<unit_float<bits>, dummy>
+{
+	enum { bit_count = bits, max_value = (1 << bits) - 1 };
+	static uint32 get(void *field)
+	{
+		float32 value = *((unit_float<bits> *) field);
+		if(value <= 0)
+			return 0;
+		if(value >= 1)
+			return max_value;
+		return uint32(value * max_value + 0.5f);
+	}
+	static void set(void *field, uint32 value)
+	{
+		*((unit_float<bits> *) field) = unit_float<bits>(float32(value) / float32(max_value));
+	}
+};
+
+/// Describes one delta slot of a class.
+struct delta_slot
+{
+	uint32 offset; ///< offset of the field in the object
+	uint32 state_index; ///< state whose mask bit marks the field as changed
+	uint32 bit_count; ///< size, in bits, of the field's quantized value
+	uint32 (*get)(void *field); ///< returns the quantized value of the field
+	void (*set)(void *field, uint32 value); ///< sets the field from a quantized value
+};
+
+/// The delta slots of a type and all of its parent classes, in the order they are written.
+struct delta_layout
+{
+	type_record *type; ///< the class the layout is for; layouts are keyed by type_record rather than type_rep, since type_records are global and outlive any type_database
+	array<delta_slot> slots;
+	net_state_mask state_mask; ///< mask of the states that have delta slots
+};
+
+enum delta_constants {
+	delta_tag_bit_size = 3, ///< Size, in bits, of the tag of an update with delta slots.
+	delta_tag_count = 1 << delta_tag_bit_size, ///< Number of recent updates each side remembers the delta slot values of.
+	max_delta_slots = 32, ///< Maximum number of delta slots in a class and its parents.
+	delta_varint_chunk_bits = 4, ///< Size, in bits, of each chunk of a variable length delta, which is followed by a continue flag.
+};
+
+/// Server side delta state of one ghost: the values sent under each tag, and which tags have been acknowledged.
+struct ghost_delta_state
+{
+	uint32 update_count; ///< Number of updates with delta slots sent; the tag of an update is its number modulo delta_tag_count.  Never reset, so that acks of a previous object's updates don't match.
+	uint32 update_id[delta_tag_count]; ///< update_count of the update last sent under each tag
+	uint32 sent_slots[delta_tag_count]; ///< bitmask of the slots written in the update last sent under each tag
+	bool acked[delta_tag_count]; ///< whether the update last sent under each tag has been acknowledged
+	array<uint32> values; ///< values sent under each tag, delta_tag_count per slot
+
+	ghost_delta_state(uint32 slot_count)
+	{
+		update_count = 0;
+		values.resize(slot_count * delta_tag_count);
+		reset();
+	}
+
+	/// Forgets all baselines, for a ghost_info reused for a new object.
+	void reset()
+	{
+		for(uint32 i = 0; i < delta_tag_count; i++)
+		{
+			update_id[i] = 0;
+			sent_slots[i] = 0;
+			acked[i] = false;
+		}
+	}
+
+	/// The state of one tag before an update is written under it, so that an update rewound out of the packet can be undone without losing the tag's acknowledged values.
+	struct saved_tag
+	{
+		uint32 update_count;
+		uint32 update_id;
+		uint32 sent_slots;
+		bool acked;
+		uint32 values[max_delta_slots]; ///< the tag's value of each slot
+	};
+
+	/// Saves the state of the tag the next update will be written under.
+	void save_next_tag(saved_tag &saved)
+	{
+		uint32 tag = (update_count + 1) & (delta_tag_count - 1);
+		saved.update_count = update_count;
+		saved.update_id = update_id[tag];
+		saved.sent_slots = sent_slots[tag];
+		saved.acked = acked[tag];
+		for(uint32 i = 0; i * delta_tag_count < values.size(); i++)
+			saved.values[i] = values[i * delta_tag_count + tag];
+	}
+
+	/// Undoes the update written since save_next_tag() saved its tag.
+	void restore_tag(saved_tag &saved)
+	{
+		update_count = saved.update_count;
+		uint32 tag = (update_count + 1) & (delta_tag_count - 1);
+		update_id[tag] = saved.update_id;
+		sent_slots[tag] = saved.sent_slots;
+		acked[tag] = saved.acked;
+		for(uint32 i = 0; i * delta_tag_count < values.size(); i++)
+			values[i * delta_tag_count + tag] = saved.values[i];
+	}
+
+	/// Returns the tag of the most recent acknowledged update that carried slot, or -1 if there is none.
+	int32 find_baseline(uint32 slot)
+	{
+		for(uint32 i = 1; i <= delta_tag_count; i++)
+		{
+			uint32 tag = (update_count - i) & (delta_tag_count - 1);
+			if(acked[tag] && (sent_slots[tag] & (1 << slot)))
+				return tag;
+		}
+		return -1;
+	}
+
+	/// Marks an update acknowledged, unless its tag has since been reused.
+	void ack(uint32 id)
+	{
+		uint32 tag = id & (delta_tag_count - 1);
+		if(update_id[tag] == id)
+			acked[tag] = true;
+	}
+};
+
+/// Global registry of delta slots by class.
+class delta_slot_registry
+{
+public:
+	/// Registers a delta slot; registering the same field again is ignored.
+	void add(type_record *type, uint32 offset, uint32 state_index, uint32 bit_count, uint32 (*get)(void *), void (*set)(void *, uint32))
+	{
+		for(uint32 i = 0; i < _slots.size(); i++)
+			if(_slots[i].type == type && _slots[i].slot.offset == offset)
+				return;
+		class_slot s;
+		s.type = type;
+		s.slot.offset = offset;
+		s.slot.state_index = state_index;
+		s.slot.bit_count = bit_count;
+		s.slot.get = get;
+		s.slot.set = set;
+		_slots.push_back(s);
+	}
+
+	/// Returns the delta layout of type_rep, or NULL if neither it nor its parents have delta slots.
+	delta_layout *get_layout(type_database::type_rep *type_rep)
+	{
+		for(uint32 i = 0; i < _layouts.size(); i++)
+			if(_layouts[i]->type == type_rep->type)
+				return _layouts[i]->slots.size() ? _layouts[i] : NULL;
+
+		delta_layout *layout = new delta_layout;
+		layout->type = type_rep->type;
+		layout->state_mask = 0;
+		for(type_database::type_rep *walk = type_rep; walk; walk = walk->parent_class)
+		{
+			for(uint32 i = 0; i < _slots.size(); i++)
+			{
+				if(_slots[i].type == walk->type)
+				{
+					layout->slots.push_back(_slots[i].slot);
+					layout->state_mask |= net_state_mask(1) << _slots[i].slot.state_index;
+				}
+			}
+		}
+		assert(layout->slots.size() <= max_delta_slots);
+		_layouts.push_back(layout);
+		return layout->slots.size() ? layout : NULL;
+	}
+
+	~delta_slot_registry()
+	{
+		for(uint32 i = 0; i < _layouts.size(); i++)
+			delete _layouts[i];
+	}
+private:
+	struct class_slot
+	{
+		type_record *type;
+		delta_slot slot;
+	};
+	array<class_slot> _slots; ///< every registered slot
+	array<delta_layout *> _layouts; ///< layouts computed so far, including empty ones
+};
+
+static delta_slot_registry &get_delta_slot_registry()
+{
+	static delta_slot_registry the_registry;
+	return the_registry;
+}
+
+template <class T> static void register_delta_slot(type_record *type, uint32 offset, uint32 state_index, T *)
+{
+	get_delta_slot_registry().add(type, offset, state_index, delta_traits<T>::bit_count, &delta_traits<T>::get, &delta_traits<T>::set);
+}
+
+/// Registers field of class_name, updated with state_index, as a delta slot.
+#define tnl_delta_slot(class_name, field, state_index) register_delta_slot(get_global_type_record<class_name>(), uint32(size_t(&(((class_name *) 0)->field))), state_index, &(((class_name *) 0)->field))
+
+/// Returns the number of bits write_delta_varint() uses for value.
+static uint32 get_delta_varint_size(uint32 value)
+{
+	uint32 size = delta_varint_chunk_bits + 1;
+	while(value >>= delta_varint_chunk_bits)
+		size += delta_varint_chunk_bits + 1;
+	return size;
+}
+
+/// Writes value in chunks of delta_varint_chunk_bits, low chunk first, each followed by a flag that is set if more chunks follow.
+static void write_delta_varint(bit_stream &bstream, uint32 value)
+{
+	for(;;)
+	{
+		bstream.write_integer(value & ((1 << delta_varint_chunk_bits) - 1), delta_varint_chunk_bits);
+		value >>= delta_varint_chunk_bits;
+		if(!bstream.write_bool(value != 0))
+			break;
+	}
+}
+
+static uint32 read_delta_varint(bit_stream &bstream)
+{
+	uint32 value = 0;
+	for(uint32 shift = 0; shift < 32; shift += delta_varint_chunk_bits)
+	{
+		value |= bstream.read_integer(delta_varint_chunk_bits) << shift;
+		if(!bstream.read_bool())
+			return value;
+	}
+	throw tnl_exception_invalid_packet;
+}
+
+/// Maps a signed difference to an unsigned value with small magnitudes near zero.
+static uint32 zigzag_encode(int32 value)
+{
+	return (uint32(value) << 1) ^ uint32(value >> 31);
+}
+
+static int32 zigzag_decode(uint32 value)
+{
+	return int32(value >> 1) ^ -int32(value & 1);
+}
@@ -18,63 +18,410 @@ enum rpc_guarantee_type {
 	rpc_unguaranteed = 2 ///< Event delivery is not guaranteed - however, the event will remain ordered relative to other unguaranteed events.
 };
 
+enum rpc_priority {
+	rpc_priority_low = 0, ///< Cosmetic events that can wait for spare packet space.
+	rpc_priority_normal = 1, ///< The default priority of registered methods.
+	rpc_priority_high = 2, ///< Events that should be written into the next packet ahead of everything else.
+	rpc_priority_count = 3,
+};
+
 class event_connection : public net_connection
 {
 public:
 	typedef net_connection parent;
+	/// rpc_broadcast holds the arguments of a single RPC call serialized once, so that the same call can be posted to any number of connections without reallocating or reserializing the functor for each one.  The bits are immutable once the broadcast is created, and are shared by reference between all the event_notes it is posted in.
+	struct rpc_broadcast : public ref_object
+	{
+		uint32 method_hash; ///< hash of the method this broadcast invokes, used to find the rpc_index on each connection
+		uint32 bit_count; ///< number of valid bits in the bits buffer
+		byte_buffer_ptr bits; ///< the serialized arguments of the call
+
+		rpc_broadcast(uint32 the_method_hash, rpc_functor *the_functor)
+		{
+			uint8 buffer[net::udp_socket::max_datagram_size];
+			bit_stream stream(buffer, sizeof(buffer));
+			
+			the_functor->write(stream, NULL);
+			method_hash = the_method_hash;
+			bit_count = stream.get_bit_position();
+			bits = new byte_buffer(buffer, stream.get_next_byte_position());
+			delete the_functor;
+		}
+	};
+	
+	/// rpc_request_id is the correlation id passed as the first argument of a method called with request(), to be passed back to respond().
+	typedef enumeration<65536> rpc_request_id;
+	
+	/// rpc_request tracks a single call made with request() until its response arrives or it times out.
+	struct rpc_request : public ref_object
+	{
+		enum request_state {
+			request_pending, ///< No response has been received yet.
+			request_completed, ///< The response was received, and is in the result field of the rpc_request_result.
+			request_timed_out, ///< No response was received before the request's timeout.
+			request_failed, ///< The response was of the wrong type, or the connection was deleted with the request outstanding.
+		};
+		request_state state; ///< current state of the request
+		uint32 request_id; ///< correlation id of the request on the wire
+		net::time timeout_time; ///< time the request times out at, or 0 for requests that never time out
+		
+		rpc_request() { state = request_pending; request_id = 0; }
+		bool is_pending() { return state == request_pending; }
+		bool is_completed() { return state == request_completed; }
+	};
+	/// rpc_request_result is the handle returned from request(), holding the response once the request is completed.
+	template <class R> struct rpc_request_result : public rpc_request
+	{
+		R result; ///< the response, valid once the state is request_completed
+	};
+	
+	/// rpc_method_stats accumulates the traffic of a single registered method on a connection, to find the methods that use the most bandwidth or see the most latency.
+	struct rpc_method_stats
+	{
+		enum {
+			latency_bucket_count = 16, ///< Number of buckets in the latency histogram.
+		};
+		uint32 call_count; ///< calls posted to this connection
+		uint32 rejected_count; ///< calls rejected by the event queue limits
+		uint32 sent_count; ///< calls written into packets, including resends
+		uint32 retransmit_count; ///< guaranteed calls resent because the packet carrying them was dropped
+		uint32 dropped_count; ///< unguaranteed calls lost with a dropped packet
+		uint32 acked_count; ///< calls the remote host is known to have received
+		uint32 received_count; ///< calls received from the remote host
+		uint64 bits_written; ///< total bits of the calls written, including resends
+		uint64 bits_read; ///< total bits of the calls received
+		uint32 latency_histogram[latency_bucket_count]; ///< time from posting a call to its acknowledgement: bucket 0 counts times under 1ms, bucket i times from 2^(i-1) to 2^i ms, and the last bucket anything longer
+		
+		rpc_method_stats() { reset(); }
+		void reset()
+		{
+			call_count = rejected_count = sent_count = retransmit_count = dropped_count = acked_count = received_count = 0;
+			bits_written = bits_read = 0;
+			for(uint32 i = 0; i < latency_bucket_count; i++)
+				latency_histogram[i] = 0;
+		}
+		void add_latency(uint32 milliseconds)
+		{
+			uint32 bucket = 0;
+			while(milliseconds && bucket < latency_bucket_count - 1)
+			{
+				milliseconds >>= 1;
+				bucket++;
+			}
+			latency_histogram[bucket]++;
+		}
+		/// Returns an upper bound, in milliseconds, on the latency that the given fraction of acknowledged calls were under.
+		uint32 get_latency_percentile(float32 fraction)
+		{
+			uint32 count = 0;
+			for(uint32 i = 0; i < latency_bucket_count; i++)
+			{
+				count += latency_histogram[i];
+				if(count && count >= fraction * acked_count)
+					return 1 << i;
+			}
+			return 0;
+		}
+	};
 protected:
 	struct rpc_record
 	{
 		uint32 method_hash;
 		rpc_guarantee_type guarantee_type;
 		rpc_direction direction;
-		functor_creator *creator;
+		uint32 ordered_channel; ///< index of the ordered_channel rpc_guaranteed_ordered calls are sequenced on
+		rpc_priority priority; ///< priority class that controls when calls of this method are written into packets
+		bool is_urgent; ///< true if posting a call of this method should send a packet right away rather than at the next regular send
+		bool is_fixed_size; ///< true if the arguments of every call of this method take exactly fixed_bit_size bits
+		uint32 fixed_bit_size; ///< bit size of the arguments, known at compile time from the method signature
+		uint32 average_bit_size; ///< running average of the bit size of the arguments of calls written so far, used to estimate the memory used by queued calls of methods that aren't fixed size
+		rpc_functor_creator *creator;
+		void *(*cast_target)(net_object *target); ///< for object RPCs, casts the target to the class the method is declared in, or returns NULL if the target is of the wrong class.  NULL for connection RPCs.
+		rpc_method_stats stats; ///< traffic of this method on the connection
 	};
 	array<rpc_record> rpc_methods;
 
 	/// event_note associates a single event posted to a connection with a sequence number for ordered processing
 	struct event_note
 	{
-		ref_ptr<functor> _rpc; ///< A safe reference to the functor
+		ref_ptr<rpc_functor> _rpc; ///< A safe reference to the functor
+		ref_ptr<rpc_broadcast> _broadcast; ///< The pre-serialized arguments of this event, if it was posted as part of a broadcast.
+		safe_ptr<net_object> _target; ///< The object an object RPC is called on.
 		uint32 rpc_index; ///< index into rpc_methods array
 		int32 _sequence_count; ///< the sequence number of this event for ordering
+		uint32 _queued_bytes; ///< estimated memory used by this event, counted against the connection's queue limits while it is waiting to be sent or acknowledged
+		net::time _post_time; ///< time the event was posted, for the latency statistics of its method
 		event_note *_next_event; ///< The next event either on the connection or on the packet_notify
 	};
+	/// ordered_channel holds the sequencing state for one independent stream of rpc_guaranteed_ordered events.  Events are only ordered relative to other events on the same channel, so a dropped packet only holds up processing of events on the channels it was carrying.
+	struct ordered_channel
+	{
+		const char *name; ///< name of the channel, for debugging output
+		event_note *send_queue_head; ///< Head of the list of events to be sent to the remote host
+		event_note *send_queue_tail; ///< Tail of the list of events to be sent to the remote host.  New events are tagged on to the end of this list
+		event_note *wait_seq_events; ///< List of events on the receiving host that are waiting on previous sequenced events to arrive.
+		event_note *notify_event_list; ///< Ordered list of events on the sending host that are waiting for receipt of processing on the client.
+		int32 next_send_event_sequence; ///< The next sequence number for an event sent on this channel
+		int32 next_receive_event_sequence; ///< The next receive event sequence to process
+		int32 last_acked_event_sequence; ///< The last event the remote host is known to have processed
+	};
+	array<ordered_channel> _ordered_channels;
+	
+	/// bulk_transfer tracks a single block of data being sent over the connection's bulk channel in bulk_fragment_size pieces.
+	struct bulk_transfer : public ref_object
+	{
+		uint32 transfer_id; ///< id of this transfer on the wire
+		byte_buffer_ptr data; ///< the data being sent
+		uint32 fragment_count; ///< number of fragments the data is split into
+		uint32 acked_fragment_count; ///< number of fragments the remote host is known to have received
+		uint32 first_unsent_fragment; ///< no fragment before this index is waiting to be sent
+		uint8 *fragment_state; ///< bulk_fragment_unsent, bulk_fragment_in_flight or bulk_fragment_acked for each fragment
+		ref_ptr<bulk_transfer> next_transfer; ///< next transfer in the connection's bulk send queue
+		
+		bulk_transfer() { fragment_state = NULL; }
+		~bulk_transfer() { delete[] fragment_state; }
+	};
+	/// bulk_fragment_note records a fragment of a bulk_transfer that was sent in a packet
+	struct bulk_fragment_note
+	{
+		ref_ptr<bulk_transfer> transfer; ///< the transfer the fragment belongs to
+		uint32 fragment_index; ///< index of the fragment in the transfer
+		bulk_fragment_note *next_fragment; ///< next fragment sent in the same packet
+	};
+	/// bulk_receive tracks the reassembly of an incoming bulk transfer
+	struct bulk_receive
+	{
+		uint32 transfer_id; ///< id of the transfer on the wire
+		uint32 size; ///< total size of the transfer, in bytes
+		uint32 fragment_count; ///< number of fragments in the transfer
+		uint32 received_fragment_count; ///< number of distinct fragments received so far
+		uint8 *buffer; ///< reassembly buffer
+		bool *fragment_received; ///< whether each fragment has been received
+	};
+	/// posted_rpc is a call made with post_rpc() from another thread, waiting to be moved into the send queues by the network thread.
+	struct posted_rpc
+	{
+		uint32 method_hash; ///< hash of the method called
+		rpc_functor *rpc; ///< the call, owned by this posted_rpc until it is drained
+		posted_rpc *next; ///< the call posted before this one
+	};
 	/// event_packet_notify tracks all the events sent with a single packet
 	struct event_packet_notify : public net_connection::packet_notify
 	{
 		event_note *event_list; ///< linked list of events sent with this packet
-		event_packet_notify() { event_list = NULL; }
+		bulk_fragment_note *bulk_list; ///< linked list of bulk fragments sent with this packet
+		connection_string_table::string_note *string_list; ///< strings written in full in this packet
+		event_packet_notify() { event_list = NULL; bulk_list = NULL; string_list = NULL; }
 	};
 public:	
-	template <typename signature> void register_rpc(signature the_method, rpc_guarantee_type guarantee_type, rpc_direction direction)
+	enum {
+		default_ordered_channel = 0, ///< The channel rpc_guaranteed_ordered methods are sequenced on unless another one is specified.
+		max_outstanding_requests = 256, ///< Maximum number of requests that can be waiting on a response at once.
+		request_slot_bit_size = 8, ///< The low bits of an rpc_request_id hold the index of the request in the outstanding request table.
+		default_max_queued_events = 4096, ///< Default limit on the number of events waiting to be sent or acknowledged.
+		default_max_queued_event_bytes = 1 << 20, ///< Default limit on the estimated memory used by events waiting to be sent or acknowledged.
+		default_max_bulk_receive_size = 1 << 18, ///< Default limit on the size of a bulk transfer accepted from the remote host.
+	};
+	
+	/// What happens when posting an event would exceed the connection's event queue limits.
+	enum event_overflow_policy {
+		event_overflow_drop_unguaranteed, ///< Free the oldest queued rpc_unguaranteed events that haven't been sent yet, lowest priority first, to make room; if that isn't enough, the new event is rejected.
+		event_overflow_reject, ///< Reject the new event.
+		event_overflow_disconnect, ///< Reject the new event and disconnect; the remote host isn't keeping up.
+	};
+	
+	/// Registers a method that can be called remotely.  rpc_guaranteed_ordered methods are sequenced on ordered_channel, which must have been returned from add_ordered_channel() or be default_ordered_channel.  Both sides of a connection must register the same methods and channels in the same order.
+	template <typename signature> void register_rpc(signature the_method, rpc_guarantee_type guarantee_type, rpc_direction direction, uint32 ordered_channel = default_ordered_channel)
 	{
+		assert(ordered_channel < _ordered_channels.size());
 		rpc_record the_record;
-		the_record.creator = new functor_creator_decl<signature>(the_method);
+		the_record.creator = new rpc_functor_creator_decl<signature>(the_method);
 		the_record.guarantee_type = guarantee_type;
 		the_record.direction = direction;
+		the_record.ordered_channel = ordered_channel;
+		the_record.priority = rpc_priority_normal;
+		the_record.is_urgent = false;
+		the_record.is_fixed_size = rpc_functor_decl<signature>::is_fixed_size;
+		the_record.fixed_bit_size = rpc_functor_decl<signature>::fixed_bit_size;
+		the_record.average_bit_size = 64;
 		the_record.method_hash = hash_method(the_method);
+		the_record.cast_target = NULL;
 		rpc_methods.push_back(the_record);
 	}
-	template <class T> void rpc(void (T::*method)())
+	
+	/// Registers a method of a net_object subclass that can be called on the ghosts of objects with net_object::ghost_rpc().  The target of each call is sent as its ghost index on this connection.
+	template <typename signature> void register_object_rpc(signature the_method, rpc_guarantee_type guarantee_type, rpc_direction direction, uint32 ordered_channel = default_ordered_channel)
+	{
+		register_rpc(the_method, guarantee_type, direction, ordered_channel);
+		rpc_methods[rpc_methods.size() - 1].cast_target = cast_rpc_target<typename rpc_functor_decl<signature>::object_type>;
+	}
+	
+	template <class T> static void *cast_rpc_target(net_object *target)
+	{
+		return dynamic_cast<T *>(target);
+	}
+	
+	/// Sets the priority class of a registered method.  Each packet, every priority class is first given its share of the space available for events, starting with rpc_priority_high, and any space left over is then filled from the highest priority down; so higher priority events are written first, but lower priority ones always get their share of the bandwidth.  Ordered events are written in sequence on their channel, so a channel is scheduled at the priority of the event at the head of its queue.
+	template <typename signature> void set_rpc_priority(signature the_method, rpc_priority priority)
+	{
+		uint32 rpc_index = find_rpc_index(hash_method(the_method));
+		assert(rpc_index != rpc_methods.size());
+		rpc_methods[rpc_index].priority = priority;
+	}
+	
+	/// Marks a registered method as urgent.  Posting a call of an urgent method asks the connection to send a packet right away instead of waiting up to a full packet send period, for things like input acknowledgements that are sensitive to latency.  Urgent packets are still limited by the packet window and by the negotiated bandwidth; see net_connection::check_urgent_send().  Urgent methods should usually also be rpc_priority_high, so that they are written first in the packet they trigger.
+	template <typename signature> void set_rpc_urgent(signature the_method, bool is_urgent = true)
+	{
+		uint32 rpc_index = find_rpc_index(hash_method(the_method));
+		assert(rpc_index != rpc_methods.size());
+		rpc_methods[rpc_index].is_urgent = is_urgent;
+	}
+	
+	/// Returns the traffic statistics of a registered method on this connection, or NULL if the method isn't registered.
+	template <typename signature> rpc_method_stats *get_rpc_stats(signature the_method)
+	{
+		uint32 rpc_index = find_rpc_index(hash_method(the_method));
+		return rpc_index == rpc_methods.size() ? NULL : &rpc_methods[rpc_index].stats;
+	}
+	
+	/// Clears the traffic statistics of every method.
+	void reset_rpc_stats()
+	{
+		for(uint32 i = 0; i < rpc_methods.size(); i++)
+			rpc_methods[i].stats.reset();
+	}
+	
+	/// Logs the traffic statistics of every method that has been called or received, most bits written first.
+	void dump_rpc_stats()
+	{
+		array<rpc_record *> records;
+		for(uint32 i = 0; i < rpc_methods.size(); i++)
+			if(rpc_methods[i].stats.call_count || rpc_methods[i].stats.received_count)
+				records.push_back(&rpc_methods[i]);
+		if(records.size())
+			qsort(&records[0], records.size(), sizeof(rpc_record *), compare_rpc_bits_written);
+		
+		logprintf("event_connection %d: rpc stats", get_torque_connection());
+		for(uint32 i = 0; i < records.size(); i++)
+		{
+			rpc_record &record = *records[i];
+			rpc_method_stats &stats = record.stats;
+			logprintf("  rpc %d (%08x): %d calls, %d rejected, %d sent, %d resent, %d dropped, %d acked, %llu bits written (%llu avg), %d received, %llu bits read, latency p50 < %dms p90 < %dms p99 < %dms",
+				uint32(&record - &rpc_methods[0]), record.method_hash, stats.call_count, stats.rejected_count, stats.sent_count, stats.retransmit_count, stats.dropped_count, stats.acked_count,
+				stats.bits_written, stats.sent_count ? stats.bits_written / stats.sent_count : uint64(0), stats.received_count, stats.bits_read,
+				stats.get_latency_percentile(0.5f), stats.get_latency_percentile(0.9f), stats.get_latency_percentile(0.99f));
+		}
+	}
+	
+	/// Calls dump_rpc_stats() every period milliseconds, or never if period is 0.
+	void set_rpc_stats_dump_period(uint32 period)
+	{
+		_rpc_stats_dump_period = period;
+		_last_rpc_stats_dump_time = net::time::get_current();
+	}
+	
+	static int compare_rpc_bits_written(const void *a, const void *b)
+	{
+		uint64 bits_a = (*((rpc_record **) a))->stats.bits_written;
+		uint64 bits_b = (*((rpc_record **) b))->stats.bits_written;
+		return bits_a < bits_b ? 1 : (bits_a > bits_b ? -1 : 0);
+	}
+	
+	/// Sets the relative share of the event space in each packet that is reserved for events of the given priority.
+	void set_rpc_priority_share(rpc_priority priority, uint32 share)
+	{
+		_priority_share[priority] = share;
+	}
+	
+	/// Limits the events this connection holds on the sending side, from when they are posted until they are acknowledged by the remote host (or dropped, for unguaranteed events), so that a remote host that stops acknowledging packets can't make the queues grow without bound.  max_events limits the number of events and max_bytes their estimated memory use; either can be 0 for no limit.  policy decides what happens to events posted beyond the limits.
+	void set_event_queue_limits(uint32 max_events, uint32 max_bytes, event_overflow_policy policy)
+	{
+		_max_queued_events = max_events;
+		_max_queued_event_bytes = max_bytes;
+		_event_overflow_policy = policy;
+		update_event_queue_pressure();
+	}
+	
+	/// Returns the number of events posted to this connection that haven't been acknowledged or dropped yet.
+	uint32 get_queued_event_count()
+	{
+		return _queued_event_count;
+	}
+	
+	/// Returns the estimated memory used by the events counted by get_queued_event_count().
+	uint32 get_queued_event_bytes()
+	{
+		return _queued_event_bytes;
+	}
+	
+	/// Returns how full the event queues are relative to their limits, from 0 (empty) to 1 (any further event overflows).
+	float32 get_event_queue_pressure()
+	{
+		float32 pressure = 0;
+		if(_max_queued_events)
+			pressure = float32(_queued_event_count) / float32(_max_queued_events);
+		if(_max_queued_event_bytes)
+			pressure = max(pressure, float32(_queued_event_bytes) / float32(_max_queued_event_bytes));
+		return pressure;
+	}
+	
+	/// Called with true when the event queue pressure rises to 75%, and with false when it falls back below 50%, so that game code can slow down whatever is producing events for this connection before they start to overflow.
+	virtual void on_event_queue_pressure(bool is_high) {}
+	
+	/// Adds an independently sequenced channel for rpc_guaranteed_ordered events and returns its index, to be passed to register_rpc().  Each connection starts with a single default channel.
+	uint32 add_ordered_channel(const char *name)
+	{
+		ordered_channel channel;
+		channel.name = name;
+		channel.send_queue_head = NULL;
+		channel.send_queue_tail = NULL;
+		channel.wait_seq_events = NULL;
+		channel.notify_event_list = NULL;
+		channel.next_send_event_sequence = first_valid_send_event_sequence;
+		channel.next_receive_event_sequence = first_valid_send_event_sequence;
+		channel.last_acked_event_sequence = -1;
+		_ordered_channels.push_back(channel);
+		return _ordered_channels.size() - 1;
+	}
+	/// Calls method on the remote host.  Returns false if the method isn't registered, or the call was rejected by the event queue limits.
+	template <class T> bool rpc(void (T::*method)())
 	{
 		uint32 method_hash = hash_method(method);
-		functor_decl<void (T::*)()> *f = new functor_decl<void (T::*)()>(method);
-		call_rpc(method_hash, f);
+		rpc_functor_decl<void (T::*)()> *f = new rpc_functor_decl<void (T::*)()>(method);
+		return call_rpc(method_hash, f);
 	}
-	template <class T, class A> void rpc(void (T::*method)(A), A arg1)
+	template <class T, class A> bool rpc(void (T::*method)(A), A arg1)
 	{
 		uint32 method_hash = hash_method(method);
-		functor_decl<void (T::*)(A)> *f = new functor_decl<void (T::*)(A)>(method);
+		rpc_functor_decl<void (T::*)(A)> *f = new rpc_functor_decl<void (T::*)(A)>(method);
 		f->set(arg1);
-		call_rpc(method_hash, f);
+		return call_rpc(method_hash, f);
 	}	
-	template <class T, class A, class B> void rpc(void (T::*method)(A,B), A arg1, B arg2)
+	template <class T, class A, class B> bool rpc(void (T::*method)(A,B), A arg1, B arg2)
 	{
 		uint32 method_hash = hash_method(method);
-		functor_decl<void (T::*)(A,B)> *f = new functor_decl<void (T::*)(A,B)>(method);
+		rpc_functor_decl<void (T::*)(A,B)> *f = new rpc_functor_decl<void (T::*)(A,B)>(method);
 		f->set(arg1,arg2);
-		call_rpc(method_hash, f);
+		return call_rpc(method_hash, f);
+	}
+	
+	/// Serializes a call to method once, returning a broadcast that can be posted to many connections with post_rpc_broadcast().
+	template <class T> static rpc_broadcast *create_rpc_broadcast(void (T::*method)())
+	{
+		rpc_functor_decl<void (T::*)()> *f = new rpc_functor_decl<void (T::*)()>(method);
+		return new rpc_broadcast(hash_method(method), f);
+	}
+	template <class T, class A> static rpc_broadcast *create_rpc_broadcast(void (T::*method)(A), A arg1)
+	{
+		rpc_functor_decl<void (T::*)(A)> *f = new rpc_functor_decl<void (T::*)(A)>(method);
+		f->set(arg1);
+		return new rpc_broadcast(hash_method(method), f);
+	}
+	template <class T, class A, class B> static rpc_broadcast *create_rpc_broadcast(void (T::*method)(A,B), A arg1, B arg2)
+	{
+		rpc_functor_decl<void (T::*)(A,B)> *f = new rpc_functor_decl<void (T::*)(A,B)>(method);
+		f->set(arg1,arg2);
+		return new rpc_broadcast(hash_method(method), f);
 	}
 	
 	/// Allocates a packet_notify for this connection
@@ -87,47 +434,73 @@ public:
 		event_packet_notify *notify = static_cast<event_packet_notify *>(pnotify);
 		
 		event_note *walk = notify->event_list;
-		event_note **insert_list = &_send_event_queue_head;
+		ordered_channel *channel = NULL;
+		event_note **insert_list = NULL;
 		event_note *temp;
 		
 		while(walk)
 		{
-			switch(rpc_methods[walk->rpc_index].guarantee_type)
+			rpc_record &record = rpc_methods[walk->rpc_index];
+			switch(record.guarantee_type)
 			{
 				case rpc_guaranteed_ordered:
 					// It was a guaranteed ordered packet, reinsert it back into
-					// _send_event_queue_head in the right place (based on seq numbers)
+					// its channel's send queue in the right place (based on seq numbers)
 					
 					TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: DroppedGuaranteed - %d", get_torque_connection(), walk->_sequence_count));
+					record.stats.retransmit_count++;
+					if(channel != &_ordered_channels[record.ordered_channel])
+					{
+						channel = &_ordered_channels[record.ordered_channel];
+						insert_list = &channel->send_queue_head;
+					}
 					while(*insert_list && (*insert_list)->_sequence_count < walk->_sequence_count)
 						insert_list = &((*insert_list)->_next_event);
 					
 					temp = walk->_next_event;
 					walk->_next_event = *insert_list;
 					if(!walk->_next_event)
-						_send_event_queue_tail = walk;
+						channel->send_queue_tail = walk;
 					*insert_list = walk;
 					insert_list = &(walk->_next_event);
 					walk = temp;
 					break;
 				case rpc_guaranteed:
 					// It was a guaranteed packet, put it at the top of
-					// _unordered_send_event_queue_head.
+					// the unordered send queue for its priority.
+					record.stats.retransmit_count++;
 					temp = walk->_next_event;
-					walk->_next_event = _unordered_send_event_queue_head;
-					_unordered_send_event_queue_head = walk;
+					walk->_next_event = _unordered_send_queue_head[record.priority];
+					_unordered_send_queue_head[record.priority] = walk;
 					if(!walk->_next_event)
-						_unordered_send_event_queue_tail = walk;
+						_unordered_send_queue_tail[record.priority] = walk;
 					walk = temp;
 					break;
 				case rpc_unguaranteed:
 					// Or else it was an unguaranteed packet, notify that
 					// it was _not_ delivered and blast it.
+					record.stats.dropped_count++;
 					temp = walk->_next_event;
-					delete walk;
+					release_event(walk);
 					walk = temp;
 			}
 		}
+		
+		_string_table.packet_dropped(notify->string_list);
+		
+		// any bulk fragments in the packet go back to being unsent
+		for(bulk_fragment_note *fragment = notify->bulk_list; fragment; )
+		{
+			bulk_fragment_note *next = fragment->next_fragment;
+			bulk_transfer *transfer = fragment->transfer;
+			
+			transfer->fragment_state[fragment->fragment_index] = bulk_fragment_unsent;
+			if(fragment->fragment_index < transfer->first_unsent_fragment)
+				transfer->first_unsent_fragment = fragment->fragment_index;
+			_bulk_fragments_in_flight--;
+			delete fragment;
+			fragment = next;
+		}
 	}
 	
 	/// Override processing to notify for delivery and dereference any events sent in the packet
@@ -138,18 +511,27 @@ public:
 		event_packet_notify *notify = static_cast<event_packet_notify *>(pnotify);
 		
 		event_note *walk = notify->event_list;
-		event_note **note_list = &_notify_event_list;
+		ordered_channel *channel = NULL;
+		event_note **note_list = NULL;
+		net::time current_time = net::time::get_current();
 		
 		while(walk)
 		{
 			event_note *next = walk->_next_event;
-			if(rpc_methods[walk->rpc_index].guarantee_type != rpc_guaranteed_ordered)
+			rpc_record &record = rpc_methods[walk->rpc_index];
+			if(record.guarantee_type != rpc_guaranteed_ordered)
 			{
-				delete walk;
+				record_event_acked(walk, current_time);
+				release_event(walk);
 				walk = next;
 			}
 			else
 			{
+				if(channel != &_ordered_channels[record.ordered_channel])
+				{
+					channel = &_ordered_channels[record.ordered_channel];
+					note_list = &channel->notify_event_list;
+				}
 				while(*note_list && (*note_list)->_sequence_count < walk->_sequence_count)
 					note_list = &((*note_list)->_next_event);
 				
@@ -159,102 +541,229 @@ public:
 				walk = next;
 			}
 		}
-		while(_notify_event_list && _notify_event_list->_sequence_count == _last_acked_event_sequence + 1)
+		for(uint32 i = 0; i < _ordered_channels.size(); i++)
+		{
+			ordered_channel &channel = _ordered_channels[i];
+			while(channel.notify_event_list && channel.notify_event_list->_sequence_count == channel.last_acked_event_sequence + 1)
+			{
+				channel.last_acked_event_sequence++;
+				event_note *next = channel.notify_event_list->_next_event;
+				TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: NotifyDelivered %s - %d", get_torque_connection(), channel.name, channel.notify_event_list->_sequence_count));
+				record_event_acked(channel.notify_event_list, current_time);
+				release_event(channel.notify_event_list);
+				channel.notify_event_list = next;
+			}
+		}
+		_string_table.packet_received(notify->string_list);
+		
+		for(bulk_fragment_note *fragment = notify->bulk_list; fragment; )
 		{
-			_last_acked_event_sequence++;
-			event_note *next = _notify_event_list->_next_event;
-			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: NotifyDelivered - %d", get_torque_connection(), _notify_event_list->_sequence_count));
-			delete _notify_event_list;
-			_notify_event_list = next;
+			bulk_fragment_note *next = fragment->next_fragment;
+			bulk_transfer *transfer = fragment->transfer;
+			
+			transfer->fragment_state[fragment->fragment_index] = bulk_fragment_acked;
+			transfer->acked_fragment_count++;
+			_bulk_fragments_in_flight--;
+			if(transfer->acked_fragment_count == transfer->fragment_count)
+			{
+				uint32 transfer_id = transfer->transfer_id;
+				remove_bulk_transfer(transfer);
+				on_bulk_data_sent(transfer_id);
+			}
+			delete fragment;
+			fragment = next;
 		}
 	}
 	
-	/// Writes pending events into the packet, and attaches them to the packet_notify
+	/// Writes pending events into the packet, and attaches them to the packet_notify.  Events are written by priority class in two passes: first each class, from highest to lowest, is limited to its share of the space available for events, then any remaining space is filled from the highest priority down.  The first pass always admits the first event of each class that fits in the packet, even if it is bigger than the class's share, so a class's large events can't be starved by steady traffic at higher priorities.
 	void write_packet(bit_stream &bstream, packet_notify *pnotify)
 	{
 		parent::write_packet(bstream, pnotify);
 		event_packet_notify *notify = static_cast<event_packet_notify *>(pnotify);
 		
-		event_note *packet_queue_head = NULL, *packet_queue_tail = NULL;
+		event_write_state state;
+		state.packet_queue_head = state.packet_queue_tail = NULL;
+		state.previous_channel = _ordered_channels.size();
+		state.previous_sequence = -2;
+		state.packet_full = false;
 		
-		while(_unordered_send_event_queue_head)
+		// start with a different channel each packet, so that a busy channel can't keep the others at the same priority from being sent
+		state.first_channel = _next_write_ordered_channel;
+		_next_write_ordered_channel = (_next_write_ordered_channel + 1) % _ordered_channels.size();
+		
+		int32 available = int32(bstream.get_bit_space_available()) - minimum_padding_bits;
+		uint32 total_share = 0;
+		for(uint32 i = 0; i < rpc_priority_count; i++)
+			total_share += _priority_share[i];
+		
+		for(int32 priority = rpc_priority_high; priority >= 0 && !state.packet_full && available > 0 && total_share; priority--)
+			write_events(bstream, state, rpc_priority(priority), available * int32(_priority_share[priority]) / int32(total_share));
+		for(int32 priority = rpc_priority_high; priority >= 0 && !state.packet_full; priority--)
+			write_events(bstream, state, rpc_priority(priority), -1);
+		
+		notify->event_list = state.packet_queue_head;
+		bstream.write_bool(false);
+	}
+	
+	/// event_write_state is the state of the event section of a packet as it is being written.
+	struct event_write_state
+	{
+		event_note *packet_queue_head; ///< events written into the packet so far
+		event_note *packet_queue_tail;
+		uint32 first_channel; ///< ordered channel to start with at each priority
+		uint32 previous_channel; ///< channel of the last ordered event written
+		int32 previous_sequence; ///< sequence number of the last ordered event written
+		bool packet_full; ///< true once an event didn't fit in the packet
+	};
+	
+	/// Returns the next event of the given priority that can be written, or NULL if there are none.  Unordered events are taken before ordered ones; ordered channels are scheduled at the priority of the event at the head of their queue.
+	event_note *get_next_event(rpc_priority priority, event_write_state &state)
+	{
+		if(_unordered_send_queue_head[priority])
+			return _unordered_send_queue_head[priority];
+		uint32 channel_count = _ordered_channels.size();
+		for(uint32 i = 0; i < channel_count; i++)
+		{
+			uint32 channel_index = (state.first_channel + i) % channel_count;
+			ordered_channel &channel = _ordered_channels[channel_index];
+			// if the channel's event window is full, it can't send anything
+			if(!channel.send_queue_head || channel.send_queue_head->_sequence_count > channel.last_acked_event_sequence + 126)
+				continue;
+			if(rpc_methods[channel.send_queue_head->rpc_index].priority == priority)
+				return channel.send_queue_head;
+		}
+		return NULL;
+	}
+	
+	/// Writes events of the given priority until there are none left, the packet is full, or bit_budget bits have been written.  A bit_budget of -1 writes as many as will fit.  The first event written is not held to bit_budget, only to the space left in the packet.
+	void write_events(bit_stream &bstream, event_write_state &state, rpc_priority priority, int32 bit_budget)
+	{
+		uint32 section_start = bstream.get_bit_position();
+		uint32 written_count = 0;
+		event_note *ev;
+		while((ev = get_next_event(priority, state)) != NULL)
 		{
 			if(bstream.is_full())
-				break;
-			// get the first event
-			event_note *ev = _unordered_send_event_queue_head;
+			{
+				state.packet_full = true;
+				return;
+			}
+			rpc_record &record = rpc_methods[ev->rpc_index];
+			bool is_ordered = record.guarantee_type == rpc_guaranteed_ordered;
+			ordered_channel *channel = is_ordered ? &_ordered_channels[record.ordered_channel] : NULL;
 			
-			bstream.write_bool(true);
-			int32 start = bstream.get_bit_position();
+			// skip serializing the event if it is already known not to fit
+			int32 argument_bits = get_event_argument_bit_size(ev);
+			if(argument_bits >= 0)
+			{
+				int32 event_bits = 1 + _rpc_id_bit_size + (is_ordered ? 8 : 0) + argument_bits;
+				if(int32(bstream.get_bit_space_available()) < event_bits + minimum_padding_bits)
+				{
+					state.packet_full = true;
+					return;
+				}
+				if(bit_budget >= 0 && written_count && int32(bstream.get_bit_position() - section_start) + event_bits > bit_budget)
+					return;
+			}
 			
+			int32 event_start = bstream.get_bit_position();
+			connection_string_table::string_note *string_mark = _string_table.get_sent_mark();
+			bstream.write_bool(true);
 			bstream.write_integer(ev->rpc_index, _rpc_id_bit_size);
-			ev->_rpc->write(bstream);
-			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: WroteEvent %d - %d bits", get_torque_connection(), ev->rpc_index, bstream.get_bit_position() - start));
-	
+			if(is_ordered && !bstream.write_bool(record.ordered_channel == state.previous_channel && ev->_sequence_count == state.previous_sequence + 1))
+				bstream.write_integer(ev->_sequence_count, 7);
+			
+			int32 argument_start = bstream.get_bit_position();
+			bool has_target = write_event_arguments(bstream, ev);
+			if(!has_target && !is_ordered)
+			{
+				// the target of this object RPC is gone, so drop the call
+				bstream.set_bit_position(event_start);
+				_string_table.rewind_sent_notes(string_mark);
+				_unordered_send_queue_head[priority] = ev->_next_event;
+				release_event(ev);
+				continue;
+			}
+			if(argument_bits < 0)
+				record.average_bit_size = (record.average_bit_size * 7 + (bstream.get_bit_position() - argument_start)) >> 3;
 			if(bstream.get_bit_space_available() < minimum_padding_bits)
 			{
-				// rewind to before this RPC
-				bstream.set_bit_position(start - 1);
-				break;
+				// rewind to before the event, and stop writing events
+				bstream.set_bit_position(event_start);
+				_string_table.rewind_sent_notes(string_mark);
+				state.packet_full = true;
+				return;
 			}
+			if(bit_budget >= 0 && written_count && int32(bstream.get_bit_position() - section_start) > bit_budget)
+			{
+				// over this priority's share for the first pass
+				bstream.set_bit_position(event_start);
+				_string_table.rewind_sent_notes(string_mark);
+				return;
+			}
+			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: WroteEvent %d - %d bits", get_torque_connection(), ev->rpc_index, bstream.get_bit_position() - event_start));
+			record.stats.sent_count++;
+			record.stats.bits_written += bstream.get_bit_position() - event_start;
+			written_count++;
 			
-			// dequeue the event and add this event onto the packet queue
-			_unordered_send_event_queue_head = ev->_next_event;
+			// dequeue the event and add it onto the packet queue
+			if(is_ordered)
+			{
+				state.previous_channel = record.ordered_channel;
+				state.previous_sequence = ev->_sequence_count;
+				channel->send_queue_head = ev->_next_event;
+			}
+			else
+				_unordered_send_queue_head[priority] = ev->_next_event;
 			ev->_next_event = NULL;
-			
-			if(!packet_queue_head)
-				packet_queue_head = ev;
+			if(!state.packet_queue_head)
+				state.packet_queue_head = ev;
 			else
-				packet_queue_tail->_next_event = ev;
-			packet_queue_tail = ev;
+				state.packet_queue_tail->_next_event = ev;
+			state.packet_queue_tail = ev;
 		}
-		
-		bstream.write_bool(false);   
-		int32 previous_sequence = -2;
-		
-		while(_send_event_queue_head)
+	}
+	
+	/// Returns the number of bits the arguments of an event will take in the packet, or -1 if it can't be known without serializing them.
+	int32 get_event_argument_bit_size(event_note *ev)
+	{
+		if(ev->_broadcast)
+			return ev->_broadcast->bit_count;
+		rpc_record &record = rpc_methods[ev->rpc_index];
+		return record.is_fixed_size ? int32(record.fixed_bit_size) : -1;
+	}
+	
+	/// Writes the arguments of an event, either by serializing its functor or by splicing in the bits of the broadcast it was posted from.  Object RPCs are preceded by their target; if the target is no longer available on the remote host, only a flag marking the call as dropped is written and false is returned.
+	bool write_event_arguments(bit_stream &bstream, event_note *ev)
+	{
+		if(rpc_methods[ev->rpc_index].cast_target)
 		{
-			if(bstream.is_full())
-				break;
-			
-			// if the event window is full, stop processing
-			if(_send_event_queue_head->_sequence_count > _last_acked_event_sequence + 126)
-				break;
-			
-			// get the first event
-			event_note *ev = _send_event_queue_head;
-			int32 eventStart = bstream.get_bit_position();
-			
+			int32 flag_position = bstream.get_bit_position();
 			bstream.write_bool(true);
-			
-			if(!bstream.write_bool(ev->_sequence_count == previous_sequence + 1))
-				bstream.write_integer(ev->_sequence_count, 7);
-			previous_sequence = ev->_sequence_count;
-
-			int32 start = bstream.get_bit_position();
-			bstream.write_integer(ev->rpc_index, _rpc_id_bit_size);
-			
-			ev->_rpc->write(bstream);
-			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: WroteEvent %d - %d bits", get_torque_connection(), ev->rpc_index, bstream.get_bit_position() - start));
-
-			if(bstream.get_bit_space_available() < minimum_padding_bits)
+			if(!ev->_target || !write_rpc_target(bstream, ev->_target))
 			{
-				// rewind to before the event, and break out of the loop:
-				bstream.set_bit_position(eventStart);
-				break;
+				bstream.set_bit_position(flag_position);
+				bstream.write_bool(false);
+				return false;
 			}
-			
-			// dequeue the event:
-			_send_event_queue_head = ev->_next_event;      
-			ev->_next_event = NULL;
-			if(!packet_queue_head)
-				packet_queue_head = ev;
-			else
-				packet_queue_tail->_next_event = ev;
-			packet_queue_tail = ev;
 		}
-		notify->event_list = packet_queue_head;
-		bstream.write_bool(0);
+		if(ev->_broadcast)
+			bstream.write_bits(ev->_broadcast->bit_count, ev->_broadcast->bits->get_buffer());
+		else
+			ev->_rpc->write(bstream, &_string_table);
+		return true;
+	}
+	
+	/// Writes a reference to the target of an object RPC, returning false without writing anything if the target isn't available on the remote host.  Connections that support object RPCs override this.
+	virtual bool write_rpc_target(bit_stream &bstream, net_object *target)
+	{
+		return false;
+	}
+	
+	/// Reads the target of an object RPC written by write_rpc_target() on the remote host.  Returns NULL if the target no longer exists.
+	virtual net_object *read_rpc_target(bit_stream &bstream)
+	{
+		throw tnl_exception_invalid_packet;
 	}
 	
 	/// Reads events from the stream, and queues them for processing
@@ -263,24 +772,30 @@ public:
 		parent::read_packet(bstream);
 		
 		int32 previous_sequence = -2;
-		event_note **wait_insert = &_wait_seq_events;
-		bool unguaranteed_phase = true;
+		ordered_channel *channel = NULL;
+		event_note **wait_insert = NULL;
 		
-		while(true)
+		while(bstream.read_bool())
 		{
-			bool bit = bstream.read_bool();
-			if(unguaranteed_phase && !bit)
-			{
-				unguaranteed_phase = false;
-				bit = bstream.read_bool();
-			}
-			if(!unguaranteed_phase && !bit)
-				break;
+			// count the flag bit just read, to match the bits counted when the event was written
+			uint32 start = bstream.get_bit_position() - 1;
+			uint32 rpc_index = bstream.read_integer(_rpc_id_bit_size);
+			fflush(stdout); // FIXME
+			if(rpc_index >= _rpc_count)
+				assert(0); // FIXME: throw tnl_exception_invalid_packet;
 			
-			int32 seq = -1;
+			rpc_record &the_rpc = rpc_methods[rpc_index];
+			bool is_ordered = the_rpc.guarantee_type == rpc_guaranteed_ordered;
 			
-			if(!unguaranteed_phase) // get the sequence
+			// ordered events are followed by their sequence number on the method's channel
+			int32 seq = -1;
+			if(is_ordered)
 			{
+				if(channel != &_ordered_channels[the_rpc.ordered_channel])
+				{
+					channel = &_ordered_channels[the_rpc.ordered_channel];
+					wait_insert = &channel->wait_seq_events;
+				}
 				if(bstream.read_bool())
 					seq = (previous_sequence + 1) & 0x7f;
 				else
@@ -288,37 +803,51 @@ public:
 				previous_sequence = seq;
 			}
 			
-			//int32 start = bstream.get_bit_position();
-			uint32 rpc_index = bstream.read_integer(_rpc_id_bit_size);
-			fflush(stdout); // FIXME
-			if(rpc_index >= _rpc_count)
-				assert(0); // FIXME: throw tnl_exception_invalid_packet;
-			
-			rpc_record &the_rpc = rpc_methods[rpc_index];
-			
-			functor *func = the_rpc.creator->create();
+			rpc_functor *func = the_rpc.creator->create();
 			
 			// check if the direction this event moves is a valid direction.
 			if(   (the_rpc.direction == rpc_initiator_to_host && is_connection_initiator())
 			   || (the_rpc.direction == rpc_host_to_initiator && is_connection_host()) )
 				assert(0); //throw tnl_exception_invalid_packet;
-			func->read(bstream);
 			
-			if(unguaranteed_phase)
+			// object RPCs whose target was gone when they were written have no arguments, but ordered ones are still sent to keep their place in the sequence
+			net_object *target = NULL;
+			bool has_arguments = true;
+			if(the_rpc.cast_target)
+			{
+				if(bstream.read_bool())
+					target = read_rpc_target(bstream);
+				else
+					has_arguments = false;
+			}
+			if(has_arguments)
+				func->read(bstream, &_string_table);
+			else
 			{
-				process_rpc(func);
 				delete func;
+				func = NULL;
+			}
+			the_rpc.stats.received_count++;
+			the_rpc.stats.bits_read += bstream.get_bit_position() - start;
+			
+			if(!is_ordered)
+			{
+				ref_ptr<rpc_functor> unordered_rpc = func;
+				if(func)
+					process_rpc(func, rpc_index, target);
 				continue;
 			}
-			seq |= (_next_receive_event_sequence & ~0x7F);
-			if(seq < _next_receive_event_sequence)
+			
+			seq |= (channel->next_receive_event_sequence & ~0x7F);
+			if(seq < channel->next_receive_event_sequence)
 				seq += 128;
 			
 			event_note *note = new event_note;
 			note->rpc_index = rpc_index;
 			note->_rpc = func;
+			note->_target = target;
 			note->_sequence_count = seq;
-			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: RecvdGuaranteed %d", get_torque_connection(), seq));
+			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: RecvdGuaranteed %s %d", get_torque_connection(), channel->name, seq));
 			
 			while(*wait_insert && (*wait_insert)->_sequence_count < seq)
 				wait_insert = &((*wait_insert)->_next_event);
@@ -327,30 +856,195 @@ public:
 			*wait_insert = note;
 			wait_insert = &(note->_next_event);
 		}
-		while(_wait_seq_events && _wait_seq_events->_sequence_count == _next_receive_event_sequence)
+		for(uint32 i = 0; i < _ordered_channels.size(); i++)
 		{
-			_next_receive_event_sequence++;
-			event_note *temp = _wait_seq_events;
-			_wait_seq_events = temp->_next_event;
-			
-			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: ProcessGuaranteed %d", get_torque_connection(), temp->_sequence_count));
-			process_rpc(temp->_rpc);
-			delete temp;
+			ordered_channel &channel = _ordered_channels[i];
+			while(channel.wait_seq_events && channel.wait_seq_events->_sequence_count == channel.next_receive_event_sequence)
+			{
+				channel.next_receive_event_sequence++;
+				event_note *temp = channel.wait_seq_events;
+				channel.wait_seq_events = temp->_next_event;
+				
+				TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: ProcessGuaranteed %s %d", get_torque_connection(), channel.name, temp->_sequence_count));
+				if(temp->_rpc)
+					process_rpc(temp->_rpc, temp->rpc_index, temp->_target);
+				delete temp;
+			}
 		}
 	}
 	
 	/// Returns true if there are events pending that should be sent across the wire
 	virtual bool is_data_to_transmit()
 	{
-		return _unordered_send_event_queue_head || _send_event_queue_head || parent::is_data_to_transmit();
+		if(has_unsent_bulk_data())
+			return true;
+		for(uint32 i = 0; i < rpc_priority_count; i++)
+			if(_unordered_send_queue_head[i])
+				return true;
+		for(uint32 i = 0; i < _ordered_channels.size(); i++)
+			if(_ordered_channels[i].send_queue_head)
+				return true;
+		return parent::is_data_to_transmit();
+	}
+	
+	/// Queues a block of data to be sent over the bulk channel.  The data is split into fragments that are written in whatever space remains at the end of each packet, after events and ghost updates, so a large transfer never delays higher priority traffic.  Fragments have their own delivery tracking and are resent if the packet carrying them is dropped; at most bulk_max_fragments_in_flight fragments are unacknowledged at any time.  Returns the id of the transfer, which is passed to on_bulk_data_sent() once the remote host has received all of it.
+	uint32 send_bulk_data(byte_buffer_ptr data)
+	{
+		assert(data->get_buffer_size() < (1 << bulk_size_bit_size));
+		
+		bulk_transfer *transfer = new bulk_transfer;
+		transfer->transfer_id = _next_bulk_transfer_id;
+		_next_bulk_transfer_id = (_next_bulk_transfer_id + 1) & ((1 << bulk_transfer_id_bit_size) - 1);
+		transfer->data = data;
+		transfer->fragment_count = get_bulk_fragment_count(data->get_buffer_size());
+		transfer->acked_fragment_count = 0;
+		transfer->first_unsent_fragment = 0;
+		transfer->fragment_state = new uint8[transfer->fragment_count];
+		memset(transfer->fragment_state, bulk_fragment_unsent, transfer->fragment_count);
+		
+		if(!_bulk_send_queue_head)
+			_bulk_send_queue_head = transfer;
+		else
+			_bulk_send_queue_tail->next_transfer = transfer;
+		_bulk_send_queue_tail = transfer;
+		return transfer->transfer_id;
+	}
+	
+	/// Returns the table used to send net_string RPC arguments over this connection.  Subclasses can use it to write strings in their own packet data, from write_packet() or write_packet_tail(), so long as anything they rewind out of the packet is also rewound from the table with rewind_sent_notes().
+	connection_string_table &get_string_table()
+	{
+		return _string_table;
+	}
+	
+	/// Limits the size of the bulk transfers this connection accepts from the remote host.  The buffer for a transfer is allocated when its first fragment arrives, so without a limit a remote host could make the connection hold bulk_max_active_transfers buffers of up to 16MB each.  A fragment of a larger transfer is an invalid packet.
+	void set_max_bulk_receive_size(uint32 max_size)
+	{
+		_max_bulk_receive_size = max_size;
+	}
+	
+	/// Called when a bulk transfer from the remote host has been completely received.
+	virtual void on_bulk_data_received(byte_buffer_ptr data) {}
+	
+	/// Called when every fragment of a bulk transfer sent with send_bulk_data() is known to have been received by the remote host.
+	virtual void on_bulk_data_sent(uint32 transfer_id) {}
+	
+	/// Writes as many bulk fragments as fit in the space remaining in the packet.
+	void write_packet_tail(bit_stream &bstream, packet_notify *pnotify)
+	{
+		parent::write_packet_tail(bstream, pnotify);
+		event_packet_notify *notify = static_cast<event_packet_notify *>(pnotify);
+		bulk_fragment_note **fragment_list = &notify->bulk_list;
+		
+		bulk_transfer *transfer;
+		uint32 fragment_index;
+		
+		while(_bulk_fragments_in_flight < bulk_max_fragments_in_flight && find_unsent_bulk_fragment(transfer, fragment_index))
+		{
+			uint32 offset = fragment_index << bulk_fragment_size_shift;
+			uint32 size = min(uint32(bulk_fragment_size), transfer->data->get_buffer_size() - offset);
+			uint32 fragment_bits = 1 + bulk_transfer_id_bit_size + bulk_size_bit_size + bulk_fragment_index_bit_size + (size << 3);
+			
+			// leave room for the terminating bit and the padding
+			if(bstream.get_bit_space_available() < fragment_bits + 1 + minimum_padding_bits)
+				break;
+			
+			bstream.write_bool(true);
+			bstream.write_integer(transfer->transfer_id, bulk_transfer_id_bit_size);
+			bstream.write_integer(transfer->data->get_buffer_size(), bulk_size_bit_size);
+			bstream.write_integer(fragment_index, bulk_fragment_index_bit_size);
+			bstream.write_bits(size << 3, transfer->data->get_buffer() + offset);
+			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: WroteBulkFragment %d:%d - %d bytes", get_torque_connection(), transfer->transfer_id, fragment_index, size));
+			
+			transfer->fragment_state[fragment_index] = bulk_fragment_in_flight;
+			_bulk_fragments_in_flight++;
+			
+			bulk_fragment_note *fragment = new bulk_fragment_note;
+			fragment->transfer = transfer;
+			fragment->fragment_index = fragment_index;
+			*fragment_list = fragment;
+			fragment_list = &fragment->next_fragment;
+		}
+		*fragment_list = NULL;
+		bstream.write_bool(false);
+		
+		// every subclass has written its part of the packet by now, so this is all the strings written in full in it
+		notify->string_list = _string_table.take_sent_notes();
 	}
 	
-	/// Dispatches an event
-	void process_rpc(functor *the_functor)
+	/// Reads bulk fragments from the end of the packet, and hands off any transfers that are now complete.
+	void read_packet_tail(bit_stream &bstream)
+	{
+		parent::read_packet_tail(bstream);
+		
+		while(bstream.read_bool())
+		{
+			uint32 transfer_id = bstream.read_integer(bulk_transfer_id_bit_size);
+			uint32 size = bstream.read_integer(bulk_size_bit_size);
+			uint32 fragment_index = bstream.read_integer(bulk_fragment_index_bit_size);
+			
+			bulk_receive *receive = find_bulk_receive(transfer_id, size);
+			if(fragment_index >= receive->fragment_count)
+				throw tnl_exception_invalid_packet;
+			
+			uint32 offset = fragment_index << bulk_fragment_size_shift;
+			uint32 fragment_size = min(uint32(bulk_fragment_size), size - offset);
+			
+			if(receive->fragment_received[fragment_index])
+			{
+				uint8 discard[bulk_fragment_size];
+				bstream.read_bits(fragment_size << 3, discard);
+				continue;
+			}
+			bstream.read_bits(fragment_size << 3, receive->buffer + offset);
+			receive->fragment_received[fragment_index] = true;
+			
+			if(++receive->received_fragment_count == receive->fragment_count)
+			{
+				byte_buffer_ptr data = new byte_buffer(receive->buffer, receive->size);
+				for(uint32 i = 0; i < _bulk_receives.size(); i++)
+				{
+					if(_bulk_receives[i] == receive)
+					{
+						_bulk_receives.erase_unstable(i);
+						break;
+					}
+				}
+				free_bulk_receive(receive);
+				TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: RecvdBulkData %d - %d bytes", get_torque_connection(), transfer_id, size));
+				if(get_connection_state() == net_connection::state_established)
+					on_bulk_data_received(data);
+			}
+		}
+	}
+	
+	/// Dispatches an event, or queues it on the interface if the interface defers RPC dispatch.
+	void process_rpc(rpc_functor *the_functor, uint32 rpc_index, net_object *target = NULL)
+	{
+		if(get_connection_state() != net_connection::state_established)
+			return;
+		if(_interface->is_rpc_dispatch_deferred())
+		{
+			rpc_record &record = rpc_methods[rpc_index];
+			_interface->defer_rpc(this, the_functor, rpc_index, record.method_hash, record.guarantee_type == rpc_guaranteed_ordered, target);
+		}
+		else
+			dispatch_rpc(the_functor, rpc_index, target);
+	}
+public:
+	/// Calls the method of a received event on this connection, or on its target object for object RPCs.  Object RPCs whose target no longer exists, or isn't of the class the method is declared in, are discarded.
+	void dispatch_rpc(rpc_functor *the_functor, uint32 rpc_index, net_object *target)
 	{
-		if(get_connection_state() == net_connection::state_established)
+		rpc_record &record = rpc_methods[rpc_index];
+		if(!record.cast_target)
 			the_functor->dispatch(this);
+		else if(target)
+		{
+			void *object = record.cast_target(target);
+			if(object)
+				the_functor->dispatch(object);
+		}
 	}
+protected:
 	
 	
 	//----------------------------------------------------------------
@@ -366,6 +1060,9 @@ protected:
 		_rpc_count = rpc_methods.size();
 		core::write(stream, _rpc_count);
 		_rpc_id_bit_size = get_next_binary_log(_rpc_count);
+		
+		uint32 channel_count = _ordered_channels.size();
+		core::write(stream, channel_count);
 	}
 	
 	/// Reads the net_event class count max that the remote host is requesting.
@@ -379,83 +1076,533 @@ protected:
 			return false;
 		
 		_rpc_id_bit_size = get_next_binary_log(_rpc_count);
+		
+		uint32 channel_count;
+		core::read(stream, channel_count);
+		if(channel_count != _ordered_channels.size())
+			return false;
 		return true;
 	}
 	
-public:
-	void call_rpc(uint32 method_hash, functor *the_functor)
+	static uint32 get_bulk_fragment_count(uint32 size)
+	{
+		// an empty transfer is still sent as a single empty fragment
+		if(!size)
+			return 1;
+		return (size + bulk_fragment_size - 1) >> bulk_fragment_size_shift;
+	}
+	
+	/// Returns true if any of the active bulk transfers has a fragment waiting to be sent and the fragment window has space for it.
+	bool has_unsent_bulk_data()
+	{
+		bulk_transfer *transfer;
+		uint32 fragment_index;
+		return _bulk_fragments_in_flight < bulk_max_fragments_in_flight && find_unsent_bulk_fragment(transfer, fragment_index);
+	}
+	
+	/// Finds the next fragment to send from the first bulk_max_active_transfers transfers in the bulk send queue.
+	bool find_unsent_bulk_fragment(bulk_transfer *&transfer, uint32 &fragment_index)
+	{
+		uint32 active_count = 0;
+		for(transfer = _bulk_send_queue_head; transfer && active_count < bulk_max_active_transfers; transfer = transfer->next_transfer, active_count++)
+		{
+			while(transfer->first_unsent_fragment < transfer->fragment_count && transfer->fragment_state[transfer->first_unsent_fragment] != bulk_fragment_unsent)
+				transfer->first_unsent_fragment++;
+			if(transfer->first_unsent_fragment < transfer->fragment_count)
+			{
+				fragment_index = transfer->first_unsent_fragment;
+				return true;
+			}
+		}
+		return false;
+	}
+	
+	/// Unlinks a completely acknowledged transfer from the bulk send queue.
+	void remove_bulk_transfer(bulk_transfer *transfer)
+	{
+		ref_ptr<bulk_transfer> hold = transfer;
+		bulk_transfer *prev = NULL;
+		for(bulk_transfer *walk = _bulk_send_queue_head; walk; prev = walk, walk = walk->next_transfer)
+		{
+			if(walk != transfer)
+				continue;
+			if(prev)
+				prev->next_transfer = walk->next_transfer;
+			else
+				_bulk_send_queue_head = walk->next_transfer;
+			if(_bulk_send_queue_tail == walk)
+				_bulk_send_queue_tail = prev;
+			walk->next_transfer = NULL;
+			break;
+		}
+	}
+	
+	/// Returns the reassembly record for the given incoming transfer, creating it if this is the first fragment received.
+	bulk_receive *find_bulk_receive(uint32 transfer_id, uint32 size)
+	{
+		for(uint32 i = 0; i < _bulk_receives.size(); i++)
+		{
+			if(_bulk_receives[i]->transfer_id != transfer_id)
+				continue;
+			if(_bulk_receives[i]->size != size)
+				throw tnl_exception_invalid_packet;
+			return _bulk_receives[i];
+		}
+		// the sender never has more than bulk_max_active_transfers transfers in progress
+		if(_bulk_receives.size() >= bulk_max_active_transfers || size > _max_bulk_receive_size)
+			throw tnl_exception_invalid_packet;
+		
+		bulk_receive *receive = new bulk_receive;
+		receive->transfer_id = transfer_id;
+		receive->size = size;
+		receive->fragment_count = get_bulk_fragment_count(size);
+		receive->received_fragment_count = 0;
+		receive->buffer = new uint8[size];
+		receive->fragment_received = new bool[receive->fragment_count];
+		for(uint32 i = 0; i < receive->fragment_count; i++)
+			receive->fragment_received[i] = false;
+		_bulk_receives.push_back(receive);
+		return receive;
+	}
+	
+	void free_event_list(event_note *list)
+	{
+		while(list)
+		{
+			event_note *temp = list;
+			list = temp->_next_event;
+			delete temp;
+		}
+	}
+	
+	void free_bulk_receive(bulk_receive *receive)
+	{
+		delete[] receive->buffer;
+		delete[] receive->fragment_received;
+		delete receive;
+	}
+	
+	/// Returns the index in rpc_methods of the method with the given hash, or rpc_methods.size() if the method was not registered on this connection.
+	uint32 find_rpc_index(uint32 method_hash)
 	{
 		uint32 rpc_index;
 		for(rpc_index = 0 ; rpc_index< rpc_methods.size(); rpc_index++)
 			if(rpc_methods[rpc_index].method_hash == method_hash)
 				break;
-		if(rpc_index == rpc_methods.size())
-			return;
-
-		rpc_record &record = rpc_methods[rpc_index];
-		
-		event_note *event = new event_note;
-		event->_rpc = the_functor;
+		return rpc_index;
+	}
+	
+	/// Appends an event to the send queue matching its RPC's guarantee type.  If the event would exceed the event queue limits, the overflow policy is applied; if the event still doesn't fit it is deleted and false is returned.
+	bool post_event(event_note *event)
+	{
+		rpc_record &record = rpc_methods[event->rpc_index];
 		event->_next_event = NULL;
-		event->rpc_index = rpc_index;
+		event->_queued_bytes = get_event_queued_bytes(event);
+		
+		if(is_event_queue_over_limit(event->_queued_bytes))
+		{
+			if(_event_overflow_policy != event_overflow_drop_unguaranteed || !drop_unguaranteed_events(event->_queued_bytes))
+			{
+				TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: EventQueueOverflow %d events, %d bytes", get_torque_connection(), _queued_event_count, _queued_event_bytes));
+				record.stats.rejected_count++;
+				delete event;
+				if(_event_overflow_policy == event_overflow_disconnect)
+					disconnect();
+				return false;
+			}
+		}
 		
 		if(record.guarantee_type == rpc_guaranteed_ordered)
 		{
-			event->_sequence_count = _next_send_event_sequence++;
-			if(!_send_event_queue_head)
-				_send_event_queue_head = event;
+			ordered_channel &channel = _ordered_channels[record.ordered_channel];
+			event->_sequence_count = channel.next_send_event_sequence++;
+			if(!channel.send_queue_head)
+				channel.send_queue_head = event;
 			else
-				_send_event_queue_tail->_next_event = event;
-			_send_event_queue_tail = event;
+				channel.send_queue_tail->_next_event = event;
+			channel.send_queue_tail = event;
 		}
 		else
 		{
 			event->_sequence_count = InvalidSendEventSeq;
-			if(!_unordered_send_event_queue_head)
-				_unordered_send_event_queue_head = event;
+			if(!_unordered_send_queue_head[record.priority])
+				_unordered_send_queue_head[record.priority] = event;
 			else
-				_unordered_send_event_queue_tail->_next_event = event;
-			_unordered_send_event_queue_tail = event;
+				_unordered_send_queue_tail[record.priority]->_next_event = event;
+			_unordered_send_queue_tail[record.priority] = event;
+		}
+		_queued_event_count++;
+		_queued_event_bytes += event->_queued_bytes;
+		update_event_queue_pressure();
+		record.stats.call_count++;
+		event->_post_time = net::time::get_current();
+		if(record.is_urgent)
+			request_urgent_send();
+		return true;
+	}
+	
+	/// Returns the estimated memory used by a queued event: the event_note itself, plus its arguments.
+	uint32 get_event_queued_bytes(event_note *ev)
+	{
+		int32 argument_bits = get_event_argument_bit_size(ev);
+		if(argument_bits < 0)
+			argument_bits = rpc_methods[ev->rpc_index].average_bit_size;
+		return sizeof(event_note) + ((argument_bits + 7) >> 3);
+	}
+	
+	/// Returns true if queueing another event of event_bytes bytes would exceed the event queue limits.
+	bool is_event_queue_over_limit(uint32 event_bytes)
+	{
+		return (_max_queued_events && _queued_event_count >= _max_queued_events) || (_max_queued_event_bytes && _queued_event_bytes + event_bytes > _max_queued_event_bytes);
+	}
+	
+	/// Frees unsent rpc_unguaranteed events, oldest and lowest priority first, until an event of event_bytes bytes fits in the queue limits.  Returns false if there weren't enough of them.
+	bool drop_unguaranteed_events(uint32 event_bytes)
+	{
+		for(uint32 priority = 0; priority < rpc_priority_count; priority++)
+		{
+			event_note **walk = &_unordered_send_queue_head[priority];
+			event_note *prev = NULL;
+			while(*walk && is_event_queue_over_limit(event_bytes))
+			{
+				event_note *ev = *walk;
+				if(rpc_methods[ev->rpc_index].guarantee_type != rpc_unguaranteed)
+				{
+					prev = ev;
+					walk = &ev->_next_event;
+					continue;
+				}
+				TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: DroppedUnguaranteed %d", get_torque_connection(), ev->rpc_index));
+				*walk = ev->_next_event;
+				if(_unordered_send_queue_tail[priority] == ev)
+					_unordered_send_queue_tail[priority] = prev;
+				release_event(ev);
+			}
+		}
+		return !is_event_queue_over_limit(event_bytes);
+	}
+	
+	/// Adds an event the remote host has acknowledged to the statistics of its method.
+	void record_event_acked(event_note *ev, net::time current_time)
+	{
+		rpc_method_stats &stats = rpc_methods[ev->rpc_index].stats;
+		stats.acked_count++;
+		stats.add_latency(current_time > ev->_post_time ? uint32((current_time - ev->_post_time).get_milliseconds()) : 0);
+	}
+	
+	/// Deletes an event on the sending side once it has been delivered or dropped, removing it from the queue accounting.
+	void release_event(event_note *ev)
+	{
+		_queued_event_count--;
+		_queued_event_bytes -= ev->_queued_bytes;
+		delete ev;
+		update_event_queue_pressure();
+	}
+	
+	/// Notifies on_event_queue_pressure() when the queue pressure crosses the high or low water mark.
+	void update_event_queue_pressure()
+	{
+		float32 pressure = get_event_queue_pressure();
+		if(!_event_queue_pressure_high && pressure * 100 >= event_queue_high_water_percent)
+		{
+			_event_queue_pressure_high = true;
+			on_event_queue_pressure(true);
+		}
+		else if(_event_queue_pressure_high && pressure * 100 < event_queue_low_water_percent)
+		{
+			_event_queue_pressure_high = false;
+			on_event_queue_pressure(false);
+		}
+	}
+	
+public:
+	bool call_rpc(uint32 method_hash, rpc_functor *the_functor)
+	{
+		uint32 rpc_index = find_rpc_index(method_hash);
+		if(rpc_index == rpc_methods.size())
+		{
+			delete the_functor;
+			return false;
+		}
+		event_note *event = new event_note;
+		event->_rpc = the_functor;
+		event->rpc_index = rpc_index;
+		return post_event(event);
+	}
+	
+	/// Posts a call serialized by create_rpc_broadcast() to this connection.  The broadcast's bits are shared rather than copied; only the event_note used for delivery tracking is allocated per connection.
+	bool post_rpc_broadcast(rpc_broadcast *the_broadcast)
+	{
+		uint32 rpc_index = find_rpc_index(the_broadcast->method_hash);
+		if(rpc_index == rpc_methods.size())
+			return false;
+		event_note *event = new event_note;
+		event->_broadcast = the_broadcast;
+		event->rpc_index = rpc_index;
+		return post_event(event);
+	}
+	
+	/// Thread safe version of rpc(), for posting calls from threads other than the one running the net_interface.  The call is pushed onto a lock-free list and moved into the connection's send queues the next time the connection checks for a packet send; calls posted from the same thread are sent in the order they were posted.
+	template <class T> void post_rpc(void (T::*method)())
+	{
+		rpc_functor_decl<void (T::*)()> *f = new rpc_functor_decl<void (T::*)()>(method);
+		push_posted_rpc(hash_method(method), f);
+	}
+	template <class T, class A> void post_rpc(void (T::*method)(A), A arg1)
+	{
+		rpc_functor_decl<void (T::*)(A)> *f = new rpc_functor_decl<void (T::*)(A)>(method);
+		f->set(arg1);
+		push_posted_rpc(hash_method(method), f);
+	}
+	template <class T, class A, class B> void post_rpc(void (T::*method)(A,B), A arg1, B arg2)
+	{
+		rpc_functor_decl<void (T::*)(A,B)> *f = new rpc_functor_decl<void (T::*)(A,B)>(method);
+		f->set(arg1, arg2);
+		push_posted_rpc(hash_method(method), f);
+	}
+	
+	/// Posts an object RPC, serialized with create_rpc_broadcast(), to be called on the ghost of target on this connection.  The ghost index of the target is resolved when the call is written into a packet.
+	bool post_object_rpc(rpc_broadcast *the_broadcast, net_object *target)
+	{
+		uint32 rpc_index = find_rpc_index(the_broadcast->method_hash);
+		if(rpc_index == rpc_methods.size() || !rpc_methods[rpc_index].cast_target)
+			return false;
+		event_note *event = new event_note;
+		event->_broadcast = the_broadcast;
+		event->_target = target;
+		event->rpc_index = rpc_index;
+		return post_event(event);
+	}
+	
+	/// Registers the method that carries responses of type R back to requesters.  Each response type used with request() and respond() must be registered on both sides of the connection, in the same order as the other rpc methods.
+	template <class R> void register_rpc_response()
+	{
+		register_rpc(&event_connection::_rpc_response<R>, rpc_guaranteed, rpc_bidirectional);
+	}
+	
+	/// Calls method on the remote host as a request expecting a response of type R.  The method's first argument is the rpc_request_id it must pass to respond().  Any number of requests can be outstanding at once, up to max_outstanding_requests; the returned handle is completed when the response arrives, or times out after timeout milliseconds if timeout is nonzero.  Returns NULL if the method isn't registered, too many requests are outstanding, or the call was rejected by the event queue limits.
+	template <class R, class T> ref_ptr<rpc_request_result<R> > request(void (T::*method)(rpc_request_id), uint32 timeout = 0)
+	{
+		ref_ptr<rpc_request_result<R> > the_request = new rpc_request_result<R>;
+		if(!add_outstanding_request(hash_method(method), the_request, timeout))
+			return NULL;
+		if(!rpc(method, rpc_request_id(the_request->request_id)))
+		{
+			take_outstanding_request(the_request->request_id);
+			return NULL;
 		}
+		return the_request;
+	}
+	template <class R, class T, class A> ref_ptr<rpc_request_result<R> > request(void (T::*method)(rpc_request_id, A), A arg1, uint32 timeout = 0)
+	{
+		ref_ptr<rpc_request_result<R> > the_request = new rpc_request_result<R>;
+		if(!add_outstanding_request(hash_method(method), the_request, timeout))
+			return NULL;
+		if(!rpc(method, rpc_request_id(the_request->request_id), arg1))
+		{
+			take_outstanding_request(the_request->request_id);
+			return NULL;
+		}
+		return the_request;
+	}
+	
+	/// Sends the response to a request received from the remote host.  R must match the response type the requester passed to request().  Returns false if the response was rejected by the event queue limits.
+	template <class R> bool respond(rpc_request_id request_id, R response)
+	{
+		return rpc(&event_connection::_rpc_response<R>, request_id, response);
 	}
 	
+	/// Called when the response to a request arrives.
+	virtual void on_request_completed(rpc_request *the_request) {}
+	
+	/// Called when a request times out without a response.
+	virtual void on_request_timed_out(rpc_request *the_request) {}
+	
 	event_connection(bool is_initiator = false) : net_connection(is_initiator)
 	{
 		// event management data:
 		
-		_notify_event_list = NULL;
-		_send_event_queue_head = NULL;
-		_send_event_queue_tail = NULL;
-		_unordered_send_event_queue_head = NULL;
-		_unordered_send_event_queue_tail = NULL;
-		_wait_seq_events = NULL;
+		for(uint32 i = 0; i < rpc_priority_count; i++)
+		{
+			_unordered_send_queue_head[i] = NULL;
+			_unordered_send_queue_tail[i] = NULL;
+		}
+		_priority_share[rpc_priority_low] = 1;
+		_priority_share[rpc_priority_normal] = 3;
+		_priority_share[rpc_priority_high] = 4;
 		
-		_next_send_event_sequence = first_valid_send_event_sequence;
-		_next_receive_event_sequence = first_valid_send_event_sequence;
-		_last_acked_event_sequence = -1;
+		add_ordered_channel("default");
+		_next_write_ordered_channel = 0;
 		_rpc_count = 0;
 		_rpc_id_bit_size = 0;
+		
+		_bulk_send_queue_tail = NULL;
+		_bulk_fragments_in_flight = 0;
+		_next_bulk_transfer_id = 0;
+		_max_bulk_receive_size = default_max_bulk_receive_size;
+		
+		_outstanding_request_count = 0;
+		_next_request_slot = 0;
+		_next_request_generation = 0;
+		
+		_posted_rpc_head = NULL;
+		
+		_queued_event_count = 0;
+		_queued_event_bytes = 0;
+		_max_queued_events = default_max_queued_events;
+		_max_queued_event_bytes = default_max_queued_event_bytes;
+		_event_overflow_policy = event_overflow_drop_unguaranteed;
+		_event_queue_pressure_high = false;
+		
+		_rpc_stats_dump_period = 0;
 	}
 	
 	~event_connection()
 	{
-		while(_notify_event_list)
+		_clear_all_packet_notifies();
+		drain_posted_rpcs(false);
+		for(uint32 i = 0; i < _bulk_receives.size(); i++)
+			free_bulk_receive(_bulk_receives[i]);
+
+		for(uint32 i = 0; i < _ordered_channels.size(); i++)
 		{
-			event_note *temp = _notify_event_list;
-			_notify_event_list = temp->_next_event;
-			delete temp;
+			ordered_channel &channel = _ordered_channels[i];
+			free_event_list(channel.notify_event_list);
+			free_event_list(channel.send_queue_head);
+			free_event_list(channel.wait_seq_events);
 		}
-		while(_unordered_send_event_queue_head)
+		for(uint32 i = 0; i < rpc_priority_count; i++)
+			free_event_list(_unordered_send_queue_head[i]);
+		
+		for(uint32 i = 0; i < max_outstanding_requests; i++)
+			if(_outstanding_requests[i])
+				_outstanding_requests[i]->state = rpc_request::request_failed;
+	}
+protected:
+	/// Assigns a request id to the_request and adds it to the outstanding request table.  Returns false if the method isn't registered or the table is full.
+	bool add_outstanding_request(uint32 method_hash, rpc_request *the_request, uint32 timeout)
+	{
+		if(_outstanding_request_count == max_outstanding_requests || find_rpc_index(method_hash) == rpc_methods.size())
+			return false;
+		
+		while(_outstanding_requests[_next_request_slot])
+			_next_request_slot = (_next_request_slot + 1) % max_outstanding_requests;
+		
+		// the high bits of the id are a generation count, so that a late response to a timed out request isn't mistaken for the response to a newer request in the same slot.
+		uint32 slot = _next_request_slot;
+		the_request->request_id = slot | ((_next_request_generation++ << request_slot_bit_size) & 0xFFFF);
+		the_request->timeout_time = timeout ? _interface->get_process_start_time() + net::time(timeout) : net::time(0);
+		_outstanding_requests[slot] = the_request;
+		_outstanding_request_count++;
+		_next_request_slot = (slot + 1) % max_outstanding_requests;
+		return true;
+	}
+	
+	/// Removes and returns the outstanding request with the given id, or NULL if there is none.
+	ref_ptr<rpc_request> take_outstanding_request(uint32 request_id)
+	{
+		uint32 slot = request_id & (max_outstanding_requests - 1);
+		ref_ptr<rpc_request> the_request = _outstanding_requests[slot];
+		if(!the_request || the_request->request_id != request_id)
+			return NULL;
+		_outstanding_requests[slot] = NULL;
+		_outstanding_request_count--;
+		return the_request;
+	}
+	
+	/// Receives the response to a request made from this host.
+	template <class R> void _rpc_response(rpc_request_id request_id, R response)
+	{
+		ref_ptr<rpc_request> the_request = take_outstanding_request(request_id);
+		if(!the_request)
 		{
-			event_note *temp = _unordered_send_event_queue_head;
-			_unordered_send_event_queue_head = temp->_next_event;
-			delete temp;
+			TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: UnknownResponse %d", get_torque_connection(), uint32(request_id)));
+			return;
 		}
-		while(_send_event_queue_head)
+		rpc_request_result<R> *the_result = dynamic_cast<rpc_request_result<R> *>((rpc_request *) the_request);
+		if(!the_result)
 		{
-			event_note *temp = _send_event_queue_head;
-			_send_event_queue_head = temp->_next_event;
-			delete temp;
+			the_request->state = rpc_request::request_failed;
+			return;
+		}
+		the_result->result = response;
+		the_result->state = rpc_request::request_completed;
+		on_request_completed(the_result);
+	}
+	
+	/// Atomically replaces *destination with value if it is still expected.
+	static bool compare_and_swap_posted_rpc(posted_rpc *volatile *destination, posted_rpc *expected, posted_rpc *value)
+	{
+#ifdef _MSC_VER
+		return InterlockedCompareExchangePointer((void *volatile *) destination, value, expected) == expected;
+#else
+		return __sync_bool_compare_and_swap(destination, expected, value);
+#endif
+	}
+	
+	/// Pushes a call onto the posted rpc list.  Safe to call from any thread.
+	void push_posted_rpc(uint32 method_hash, rpc_functor *the_functor)
+	{
+		posted_rpc *node = new posted_rpc;
+		node->method_hash = method_hash;
+		node->rpc = the_functor;
+		do
+			node->next = _posted_rpc_head;
+		while(!compare_and_swap_posted_rpc(&_posted_rpc_head, node->next, node));
+	}
+	
+	/// Takes every call from the posted rpc list and, if post is true, queues them for sending in the order they were posted.  Only called from the network thread.
+	void drain_posted_rpcs(bool post)
+	{
+		posted_rpc *list;
+		do
+			list = _posted_rpc_head;
+		while(list && !compare_and_swap_posted_rpc(&_posted_rpc_head, list, NULL));
+		
+		// the list is newest first, so reverse it before posting
+		posted_rpc *ordered = NULL;
+		while(list)
+		{
+			posted_rpc *next = list->next;
+			list->next = ordered;
+			ordered = list;
+			list = next;
+		}
+		while(ordered)
+		{
+			posted_rpc *next = ordered->next;
+			if(post)
+				call_rpc(ordered->method_hash, ordered->rpc);
+			else
+				delete ordered->rpc;
+			delete ordered;
+			ordered = next;
+		}
+	}
+	
+	/// Moves calls posted from other threads into the send queues, and times out any requests whose timeout has passed.
+	void on_check_packet_send(net::time current_time)
+	{
+		parent::on_check_packet_send(current_time);
+		if(_posted_rpc_head)
+			drain_posted_rpcs(true);
+		if(_rpc_stats_dump_period && current_time - _last_rpc_stats_dump_time >= net::time(_rpc_stats_dump_period))
+		{
+			_last_rpc_stats_dump_time = current_time;
+			dump_rpc_stats();
+		}
+		if(!_outstanding_request_count)
+			return;
+		for(uint32 i = 0; i < max_outstanding_requests; i++)
+		{
+			rpc_request *the_request = _outstanding_requests[i];
+			if(the_request && the_request->timeout_time != net::time(0) && the_request->timeout_time <= current_time)
+			{
+				ref_ptr<rpc_request> timed_out = take_outstanding_request(the_request->request_id);
+				timed_out->state = rpc_request::request_timed_out;
+				TorqueLogMessageFormatted(LogEventConnection, ("event_connection %d: RequestTimedOut %d", get_torque_connection(), timed_out->request_id));
+				on_request_timed_out(timed_out);
+			}
 		}
 	}
 private:
@@ -464,18 +1611,53 @@ private:
 		debug_checksum = 0xF00DBAAD,
 		bit_stream_position_bit_size = 16,
 		InvalidSendEventSeq = -1,
-		first_valid_send_event_sequence = 0
+		first_valid_send_event_sequence = 0,
+		
+		bulk_transfer_id_bit_size = 8, ///< Size, in bits, of the id of each bulk transfer on the wire.
+		bulk_size_bit_size = 24, ///< Size, in bits, of the byte count of a bulk transfer, limiting transfers to 16MB.
+		bulk_fragment_size_shift = 7,
+		bulk_fragment_size = 1 << bulk_fragment_size_shift, ///< Size, in bytes, of each bulk fragment.
+		bulk_fragment_index_bit_size = bulk_size_bit_size - bulk_fragment_size_shift, ///< Size, in bits, of a fragment index.
+		bulk_max_fragments_in_flight = 64, ///< Maximum number of sent but unacknowledged bulk fragments.
+		bulk_max_active_transfers = 4, ///< Maximum number of bulk transfers sent from at once; later transfers wait in the queue.
+		
+		bulk_fragment_unsent = 0,
+		bulk_fragment_in_flight,
+		bulk_fragment_acked,
+		
+		event_queue_high_water_percent = 75, ///< Queue pressure, in percent, at which on_event_queue_pressure(true) is called.
+		event_queue_low_water_percent = 50, ///< Queue pressure, in percent, at which on_event_queue_pressure(false) is called.
 	};
-	event_note *_send_event_queue_head; ///< Head of the list of events to be sent to the remote host
-	event_note *_send_event_queue_tail; ///< Tail of the list of events to be sent to the remote host.  New events are tagged on to the end of this list
-	event_note *_unordered_send_event_queue_head; ///< Head of the list of events sent without ordering information
-	event_note *_unordered_send_event_queue_tail; ///< Tail of the list of events sent without ordering information
-	event_note *_wait_seq_events;   ///< List of ordered events on the receiving host that are waiting on previous sequenced events to arrive.
-	event_note *_notify_event_list; ///< Ordered list of events on the sending host that are waiting for receipt of processing on the client.
-	
-	int32 _next_send_event_sequence; ///< The next sequence number for an ordered event sent through this connection
-	int32 _next_receive_event_sequence; ///< The next receive event sequence to process
-	int32 _last_acked_event_sequence; ///< The last event the remote host is known to have processed
+	event_note *_unordered_send_queue_head[rpc_priority_count]; ///< Heads of the lists of events sent without ordering information, by priority
+	event_note *_unordered_send_queue_tail[rpc_priority_count]; ///< Tails of the lists of events sent without ordering information, by priority
+	uint32 _priority_share[rpc_priority_count]; ///< Relative share of each packet's event space reserved for each priority.
+	uint32 _next_write_ordered_channel; ///< The ordered channel write_packet starts with in the next packet.
+	
+	ref_ptr<bulk_transfer> _bulk_send_queue_head; ///< Head of the list of bulk transfers waiting to be sent or acknowledged.
+	bulk_transfer *_bulk_send_queue_tail; ///< Tail of the bulk transfer list.  New transfers are added to the end of this list.
+	uint32 _bulk_fragments_in_flight; ///< Number of bulk fragments sent in packets that haven't been notified yet.
+	uint32 _next_bulk_transfer_id; ///< Wire id of the next transfer queued with send_bulk_data().
+	array<bulk_receive *> _bulk_receives; ///< Incoming bulk transfers that are being reassembled.
+	uint32 _max_bulk_receive_size; ///< Largest incoming bulk transfer accepted, in bytes.
+	
+	ref_ptr<rpc_request> _outstanding_requests[max_outstanding_requests]; ///< Requests waiting on a response, indexed by the low bits of their request id.
+	uint32 _outstanding_request_count; ///< Number of requests in _outstanding_requests.
+	uint32 _next_request_slot; ///< Slot to start searching from for the next request.
+	uint32 _next_request_generation; ///< Generation count stored in the high bits of the next request id.
+	
+	posted_rpc *volatile _posted_rpc_head; ///< Calls posted with post_rpc() that haven't been queued yet, newest first.
+	
+	connection_string_table _string_table; ///< Strings sent and received as net_string arguments.
+	
+	uint32 _rpc_stats_dump_period; ///< Milliseconds between calls to dump_rpc_stats(), or 0 for never.
+	net::time _last_rpc_stats_dump_time; ///< Time dump_rpc_stats() was last called from on_check_packet_send().
+	
+	uint32 _queued_event_count; ///< Number of events posted to this connection that haven't been acknowledged or dropped.
+	uint32 _queued_event_bytes; ///< Estimated memory used by the queued events.
+	uint32 _max_queued_events; ///< Limit on _queued_event_count, or 0 for no limit.
+	uint32 _max_queued_event_bytes; ///< Limit on _queued_event_bytes, or 0 for no limit.
+	event_overflow_policy _event_overflow_policy; ///< What to do with events posted beyond the limits.
+	bool _event_queue_pressure_high; ///< True between the on_event_queue_pressure(true) and on_event_queue_pressure(false) notifications.
 	
 	uint32 _rpc_count; ///< Number of net_event classes supported by this connection
 	uint32 _rpc_id_bit_size; ///< Bit field width of net_event class count.
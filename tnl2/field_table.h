@@ -0,0 +1,163 @@
+/// Returns the index of the lowest set bit of value, which must not be 0.
+static uint32 count_trailing_zeros(uint32 value)
+{
+#if defined(__GNUC__)
+	return __builtin_ctz(value);
+#else
+	static const uint8 de_bruijn_bit_position[32] = {
+		0, 1, 28, 2, 29, 14, 24, 3, 30, 22, 20, 15, 25, 17, 4, 8,
+		31, 27, 13, 23, 21, 19, 16, 7, 26, 12, 18, 6, 11, 5, 10, 9
+	};
+	return de_bruijn_bit_position[((value & -int32(value)) * 0x077CB531U) >> 27];
+#endif
+}
+
+static uint32 count_trailing_zeros(uint64 value)
+{
+#if defined(__GNUC__)
+	return __builtin_ctzll(value);
+#else
+	return uint32(value) ? count_trailing_zeros(uint32(value)) : 32 + count_trailing_zeros(uint32(value >> 32));
+#endif
+}
+
+/// ghost_field_table is the flattened list of the fields a ghost update of one class writes, grouped by state index so that an update visits only the fields of the states in its mask.
+///
+/// It is built once from the type_rep: fields from the whole parent class chain are gathered together, and the fields of compound types are inlined with their offsets added to the compound field's, so writing an update is a loop over the set bits of the mask and, for each, a loop over a contiguous run of fields calling their write functions directly.  The class's string slots are included with the fields of their states, and are written through the connection's string table.
+struct ghost_field_table
+{
+	/// A field of the class, or of a compound type inlined into it.
+	struct field
+	{
+		uint32 offset; ///< offset of the field from the start of the object
+		type_database::field_rep *field_rep; ///< the field's description, for its read and write functions, or NULL if the field is a string slot
+	};
+	enum {
+		max_states = max_net_states,
+	};
+
+	type_database::type_rep *type_rep; ///< the class this table is for
+	array<field> fields; ///< the fields, ordered by state index
+	uint32 state_start[max_states + 1]; ///< fields of state i are fields[state_start[i]] through fields[state_start[i + 1] - 1]
+	net_state_mask string_state_mask; ///< states that have string slots, whose updates are particular to each connection
+
+	ghost_field_table(type_database::type_rep *the_type_rep)
+	{
+		type_rep = the_type_rep;
+		string_state_mask = 0;
+		array<string_slot> string_slots;
+		for(type_database::type_rep *walk = type_rep; walk; walk = walk->parent_class)
+			get_string_slot_registry().get_slots(walk->type, string_slots);
+		
+		for(uint32 state = 0; state < max_states; state++)
+		{
+			state_start[state] = fields.size();
+			for(type_database::type_rep *walk = type_rep; walk; walk = walk->parent_class)
+			{
+				for(dictionary<type_database::field_rep>::pointer i = walk->fields.first(); i; ++i)
+				{
+					type_database::field_rep *field_rep = i.value();
+					if(field_rep->state_index == state)
+						add_field(field_rep, field_rep->offset);
+				}
+			}
+			for(uint32 i = 0; i < string_slots.size(); i++)
+			{
+				if(string_slots[i].state_index != state)
+					continue;
+				field the_field;
+				the_field.offset = string_slots[i].offset;
+				the_field.field_rep = NULL;
+				fields.push_back(the_field);
+				string_state_mask |= net_state_mask(1) << state;
+			}
+		}
+		state_start[max_states] = fields.size();
+	}
+
+	/// Writes the fields of the states in update_mask, with string slots going through strings, and returns the mask of states whose fields asked to be written again.
+	net_state_mask write(bit_stream &bstream, void *object_pointer, net_state_mask update_mask, connection_string_table *strings)
+	{
+		net_state_mask returned_mask = 0;
+		while(update_mask)
+		{
+			uint32 state = count_trailing_zeros(update_mask);
+			update_mask &= update_mask - 1;
+			for(uint32 i = state_start[state]; i < state_start[state + 1]; i++)
+			{
+				field &the_field = fields[i];
+				if(!the_field.field_rep)
+					strings->write(bstream, *((net_string *) ((uint8 *) object_pointer + the_field.offset)));
+				else if(!the_field.field_rep->write_function(bstream, (uint8 *) object_pointer + the_field.offset))
+					returned_mask |= net_state_mask(1) << state;
+			}
+		}
+		return returned_mask;
+	}
+
+	/// Reads the fields of the states in update_mask.
+	void read(bit_stream &bstream, void *object_pointer, net_state_mask update_mask, connection_string_table *strings)
+	{
+		while(update_mask)
+		{
+			uint32 state = count_trailing_zeros(update_mask);
+			update_mask &= update_mask - 1;
+			for(uint32 i = state_start[state]; i < state_start[state + 1]; i++)
+			{
+				field &the_field = fields[i];
+				if(!the_field.field_rep)
+					strings->read(bstream, *((net_string *) ((uint8 *) object_pointer + the_field.offset)));
+				else
+					the_field.field_rep->read_function(bstream, (uint8 *) object_pointer + the_field.offset);
+			}
+		}
+	}
+private:
+	/// Adds a field at offset, replacing a compound field with all of the fields of its type.
+	void add_field(type_database::field_rep *field_rep, uint32 offset)
+	{
+		if(!field_rep->compound_type)
+		{
+			field the_field;
+			the_field.offset = offset;
+			the_field.field_rep = field_rep;
+			fields.push_back(the_field);
+			return;
+		}
+		for(type_database::type_rep *walk = field_rep->compound_type; walk; walk = walk->parent_class)
+			for(dictionary<type_database::field_rep>::pointer i = walk->fields.first(); i; ++i)
+				add_field(i.value(), offset + i.value()->offset);
+	}
+};
+
+/// Global registry of ghost field tables by class, so each class's table is built once and shared by every connection that ghosts it.
+class ghost_field_table_registry
+{
+public:
+	/// Returns the field table of type_rep, building it the first time the class is asked for.  Tables are keyed by the class's type_record; a type_database that describes the same class again gets its own table, since the table refers to its field_reps.
+	ghost_field_table *get_table(type_database::type_rep *type_rep)
+	{
+		for(uint32 i = 0; i < _tables.size(); i++)
+			if(_tables[i]->type_rep->type == type_rep->type && _tables[i]->type_rep == type_rep)
+				return _tables[i];
+
+		assert(type_rep->max_state_index <= max_net_states);
+		ghost_field_table *table = new ghost_field_table(type_rep);
+		_tables.push_back(table);
+		return table;
+	}
+
+	~ghost_field_table_registry()
+	{
+		for(uint32 i = 0; i < _tables.size(); i++)
+			delete _tables[i];
+	}
+private:
+	array<ghost_field_table *> _tables; ///< tables built so far
+};
+
+static ghost_field_table_registry &get_ghost_field_table_registry()
+{
+	static ghost_field_table_registry the_registry;
+	return the_registry;
+}
@@ -1,7 +1,7 @@
 /// ghost_connection is a subclass of event_connection that manages the transmission (ghosting) and updating of NetObjects over a connection.  The ghost_connection is responsible for doing scoping calculations (on the server side) and transmitting most-recent ghost information to the client.
-/// ghosting is the most complex, and most powerful, part of TNL's capabilities. It allows the information sent to clients to be very precisely matched to what they need, so that no excess bandwidth is wasted.  Each ghost_connection has a <b>scope object</b> that is responsible for determining what other net_object instances are relevant to that connection's client.  Each time ghost_connection sends a packet, net_object::perform_scope_query() is called on the scope object, which calls ghost_connection::object_in_scope() for each relevant object.
+/// ghosting is the most complex, and most powerful, part of TNL's capabilities. It allows the information sent to clients to be very precisely matched to what they need, so that no excess bandwidth is wasted.  Each ghost_connection has a <b>scope object</b> that is responsible for determining what other net_object instances are relevant to that connection's client.  Each time ghost_connection sends a packet, net_object::perform_scope_query() is called on the scope object, which calls ghost_connection::object_in_scope() for each relevant object.  The query can be run less often with set_scope_query_period() and set_scope_query_movement_threshold(), in which case objects stay in scope between queries.
 /// Each object that is in scope, and in need of update (based on its maskbits) is given a priority ranking by calling that object's getUpdatePriority() method.  The packet is then filled with updates, ordered by priority. This way the most important updates get through first, with less important updates being sent as space is available.
-/// There is a cap on the maximum number of ghosts that can be active through a ghost_connection at once.  The enum ghost_id_bit_size (defaults to 10) determines how many bits will be used to transmit the ID for each ghost, so the maximum number is 2^ghost_id_bit_size or 1024.  This can be easily raised; see the  ghost_constants enum.
+/// There is a cap on the maximum number of ghosts that can be active through a ghost_connection at once.  The enum ghost_id_bit_size (defaults to 16) determines the largest ghost ID, so the maximum number is 2^ghost_id_bit_size or 65536; see the ghost_constants enum.  The ghost ID space grows on demand in blocks of ghost_block_size, so a connection only allocates tracking for as many ghosts as it has had in scope at once, and IDs are written with only as many bits as the highest ID in use needs.
 /// Each object ghosted is assigned a ghost ID; the client is <b>only</b> aware of the ghost ID. This acts to enhance simulation security, as it becomes difficult to map objects from one connection to another, or to reliably identify objects from ID alone. IDs are also reassigned based on need, making it hard to track objects that have fallen out of scope (as any object which the player shouldn't see would).
 /// resolve_ghost() is used on the client side, and resolveObjectFromGhostIndex() on the server side, to convert ghost IDs to object references.
 /// @see net_object for more information on network object functionality.
@@ -14,11 +14,12 @@ public:
 	/// When we are notified that a pack is sent/lost, this is used to determine what updates need to be resent and so forth.
 	struct ghost_ref
 	{
-		uint32 mask; ///< The mask of bits that were updated in this packet
+		net_state_mask mask; ///< The mask of bits that were updated in this packet
 		uint32 ghost_info_flags; ///< ghost_info::Flags bitset, determes if the ghost is in a special processing mode (created/deleted)
 		ghost_info *ghost; ///< The ghost information for the object on the connection that sent the packet this ghost_ref is attached to
 		ghost_ref *next_ref; ///< The next ghost updated in this packet
 		ghost_ref *update_chain; ///< A pointer to the ghost_ref on the least previous packet that updated this ghost, or NULL, if no prior packet updated this ghost
+		uint32 delta_update; ///< ghost_delta_state::update_count of the delta slots written in this update, or 0 if none were
 	};
 	
 	/// Notify structure attached to each packet with information about the ghost updates in the packet
@@ -28,10 +29,20 @@ public:
 		ghost_packet_notify() { ghost_list = NULL; }
 	};
 	
+	/// The scope this connection keeps for a replication_node, indexed by the node's id.
+	struct node_scope
+	{
+		ref_ptr<replication_node> node; ///< the node, or NULL if the last query didn't include it
+		uint32 version; ///< the node's version when the connection last followed its changes
+		uint32 stamp; ///< _node_scope_stamp of the last query that included the node
+	};
+	
 	type_database *_type_database;
+	array<ghost_field_table *> _field_tables; ///< The shared field tables of the ghostable classes, by class index, looked up in the ghost_field_table_registry as they are needed.
 	
 	void set_type_database(type_database *type_db)
 	{
+		_field_tables.clear();
 		_type_database = type_db;
 	}
 protected:
@@ -52,7 +63,7 @@ protected:
 		{
 			ghost_ref *temp = packet_ref->next_ref;
 			
-			uint32 update_flags = packet_ref->mask;
+			net_state_mask update_flags = packet_ref->mask;
 			
 			// figure out which flags need to be updated on the object
 			for(ghost_ref *walk = packet_ref->update_chain; walk && update_flags; walk = walk->update_chain)
@@ -94,7 +105,7 @@ protected:
 				packet_ref->ghost->flags &= ~ghost_info::killing_ghost;
 			}
 			
-			delete packet_ref;
+			free_ghost_ref(packet_ref);
 			packet_ref = temp;
 		}
 	}
@@ -116,6 +127,10 @@ protected:
 				packet_ref->ghost->last_update_chain = NULL;
 			
 			ghost_ref *temp = packet_ref->next_ref;      
+			// the delta slot values sent in this update can now be used as baselines
+			if(packet_ref->delta_update && packet_ref->ghost->delta_state)
+				packet_ref->ghost->delta_state->ack(packet_ref->delta_update);
+			
 			// if this object was ghosting , it is now ghosted
 			
 			if(packet_ref->ghost_info_flags & ghost_info::ghosting)
@@ -129,18 +144,82 @@ protected:
 			else if(packet_ref->ghost_info_flags & ghost_info::killing_ghost)
 				free_ghost_info(packet_ref->ghost);
 			
-			delete packet_ref;
+			free_ghost_ref(packet_ref);
 			packet_ref = temp;
 		}
 	}
 	
-	static int compare_priority(const void *a,const void *b)
+	/// Swaps two entries of the ghost array, keeping their array_index fields in step.
+	void swap_ghost_array_entries(int32 a, int32 b)
 	{
-		ghost_info *ga = *((ghost_info **) a);
-		ghost_info *gb = *((ghost_info **) b);
-
-		float32 ret = ga->priority - gb->priority;
-		return (ret < 0) ? -1 : ((ret > 0) ? 1 : 0);
+		if(a == b)
+			return;
+		ghost_info *temp = _ghost_array[a];
+		_ghost_array[a] = _ghost_array[b];
+		_ghost_array[b] = temp;
+		_ghost_array[a]->array_index = a;
+		_ghost_array[b]->array_index = b;
+	}
+	
+	/// Partitions _ghost_array[low, high] around the median of three priorities.  On return every entry in [low, j] has a priority no higher than the pivot, every entry in [i, high] has a priority no lower, and any entries between j and i are equal to it.
+	void partition_ghosts(int32 low, int32 high, int32 &i, int32 &j)
+	{
+		float32 a = _ghost_array[low]->priority;
+		float32 b = _ghost_array[low + ((high - low) >> 1)]->priority;
+		float32 c = _ghost_array[high]->priority;
+		float32 pivot = a < b ? (b < c ? b : (a < c ? c : a)) : (a < c ? a : (b < c ? c : b));
+		
+		i = low;
+		j = high;
+		while(i <= j)
+		{
+			while(_ghost_array[i]->priority < pivot)
+				i++;
+			while(_ghost_array[j]->priority > pivot)
+				j--;
+			if(i <= j)
+				swap_ghost_array_entries(i++, j--);
+		}
+	}
+	
+	/// Sorts _ghost_array[low, high] in ascending priority order.
+	void sort_ghosts(int32 low, int32 high)
+	{
+		while(low < high)
+		{
+			int32 i, j;
+			partition_ghosts(low, high, i, j);
+			// recurse into the smaller side, to bound the stack depth
+			if(j - low < high - i)
+			{
+				sort_ghosts(low, j);
+				low = i;
+			}
+			else
+			{
+				sort_ghosts(i, high);
+				high = j;
+			}
+		}
+	}
+	
+	/// Moves the highest priority ghosts of _ghost_array[0, end) into [first, end), sorted in ascending priority order, leaving the lower priority ones unordered below first.  This is a quickselect of the boundary followed by a sort of only the selected entries, so selecting the few dozen updates that fit in a packet doesn't cost a sort of every dirty ghost.
+	void select_highest_priority_ghosts(int32 first, int32 end)
+	{
+		int32 low = 0;
+		int32 high = end - 1;
+		while(first > low && low < high)
+		{
+			int32 i, j;
+			partition_ghosts(low, high, i, j);
+			if(first <= j)
+				high = j;
+			else if(first >= i)
+				low = i;
+			else
+				break;
+		}
+		sort_ghosts(first, end - 1);
 	}
 	
 	/// Performs the scoping query in order to determine if there is data to send from this ghost_connection.
@@ -158,21 +237,169 @@ protected:
 		// Each packet we loop through all the objects with non-zero masks and
 		// mark them as "out of scope" before the scope query runs.
 		// if the object has a zero update mask, we wait to remove it until it requests
-		// an update
+		// an update.  If the query isn't due this packet, the in_scope flags from
+		// the last query stand.
 		
+		bool query_due = is_scope_query_due();
 		for(int32 i = 0; i < _ghost_zero_update_index; i++)
 		{
 			// increment the updateSkip for everyone... it's all good
 			ghost_info *walk = _ghost_array[i];
 			walk->update_skip_count++;
-			if(!(walk->flags & (ghost_info::scope_local_always)))
+			if(query_due && !(walk->flags & (ghost_info::scope_local_always)))
 				walk->flags &= ~ghost_info::in_scope;
 		}
+		if(!query_due)
+			return;
+		
+		// when queries are run less often than every packet, objects with no
+		// pending updates are checked as well, so that they leave scope now
+		// rather than whenever they next change.
+		bool check_all = is_scope_query_incremental();
+		if(check_all)
+		{
+			for(int32 i = _ghost_zero_update_index; i < _ghost_free_index; i++)
+				if(!(_ghost_array[i]->flags & ghost_info::scope_local_always))
+					_ghost_array[i]->flags &= ~ghost_info::in_scope;
+		}
+		
+		_scope_query_pending = false;
+		_last_scope_query_time = _interface->get_process_start_time();
+		begin_node_scope();
 		if(_scope_object)
 		{
+			_scope_object->get_scope_position(_last_scope_query_x, _last_scope_query_y);
 			logprintf("performing scope query.");
 			_scope_object->perform_scope_query(this);			
 		}
+		end_node_scope();
+		
+		if(check_all)
+		{
+			// leave_scope moves the ghost below _ghost_zero_update_index, swapping
+			// down an entry that has already been checked.
+			for(int32 i = _ghost_zero_update_index; i < _ghost_free_index; i++)
+				if(!is_ghost_in_scope(_ghost_array[i]))
+					leave_scope(_ghost_array[i]);
+		}
+	}
+	
+	/// Returns true if the scope query should run before the next packet is written.
+	bool is_scope_query_due()
+	{
+		if(_scope_query_pending || !is_scope_query_incremental())
+			return true;
+		if(_scope_query_period && _interface->get_process_start_time() - _last_scope_query_time >= net::time(_scope_query_period))
+			return true;
+		float32 x, y;
+		if(_scope_query_movement_threshold > 0 && _scope_object && _scope_object->get_scope_position(x, y))
+		{
+			float32 dx = x - _last_scope_query_x;
+			float32 dy = y - _last_scope_query_y;
+			if(dx * dx + dy * dy >= _scope_query_movement_threshold * _scope_query_movement_threshold)
+				return true;
+		}
+		return false;
+	}
+	
+	/// Returns true if the scope query is set to run less often than every packet.
+	bool is_scope_query_incremental()
+	{
+		return _scope_query_period != 0 || _scope_query_movement_threshold > 0;
+	}
+	
+	/// Returns true if the ghost's object is in scope: marked by the scope query, scoped always, or in a replication_node included by the last query.
+	static bool is_ghost_in_scope(ghost_info *info)
+	{
+		return (info->flags & (ghost_info::in_scope | ghost_info::scope_local_always)) || info->node_scope_count;
+	}
+	
+	/// Detaches a ghost whose object has left scope, and notifies on_scope_leave().
+	void leave_scope(ghost_info *info)
+	{
+		net_object *object = info->obj;
+		detach_object(info);
+		if(object)
+			on_scope_leave(object);
+	}
+	
+	/// Applies the changes node has logged since the connection last followed it.  If the node's log no longer reaches back that far, every node's scope is recounted at the end of the query.
+	void sync_node_scope(node_scope &record)
+	{
+		replication_node *node = record.node;
+		uint32 behind = node->_version - record.version;
+		if(!behind)
+			return;
+		uint32 change_count = node->_changes.size();
+		if(behind > change_count)
+			_node_scope_lost = true;
+		else
+		{
+			for(uint32 i = change_count - behind; i < change_count; i++)
+			{
+				if(node->_changes[i].added)
+					add_node_scope(node->_changes[i].object);
+				else
+					remove_node_scope(node->_changes[i].object);
+			}
+		}
+		record.version = node->_version;
+	}
+	
+	/// Counts one more included node containing object.
+	void add_node_scope(net_object *object)
+	{
+		// deleted objects are NULL in node lists, and their ghosts are already gone
+		if(!object)
+			return;
+		ghost_info *info = add_ghost(object);
+		if(info)
+			info->node_scope_count++;
+	}
+	
+	/// Counts one less included node containing object, and takes it out of scope if nothing else holds it there.
+	void remove_node_scope(net_object *object)
+	{
+		if(!object)
+			return;
+		ghost_info *info = find_ghost_info(object);
+		if(!info || !info->node_scope_count)
+			return;
+		if(!--info->node_scope_count)
+			_node_scope_leaving.push_back(info);
+	}
+	
+	/// Recounts the nodes containing each ghost from the nodes' current objects, after a node's change log was outrun.
+	void recount_node_scopes()
+	{
+		_node_scope_lost = false;
+		for(int32 i = 0; i < _ghost_free_index; i++)
+		{
+			ghost_info *info = _ghost_array[i];
+			if(info->node_scope_count)
+			{
+				_node_scope_leaving.push_back(info);
+				info->node_scope_count = 0;
+			}
+		}
+		for(uint32 i = 0; i < _scoped_node_ids.size(); i++)
+		{
+			node_scope &record = _node_scopes[_scoped_node_ids[i]];
+			replication_node *node = record.node;
+			record.version = node->_version;
+			for(uint32 j = 0; j < node->_objects.size(); j++)
+				add_node_scope(node->_objects[j]);
+		}
+	}
+	
+	/// Forgets the included nodes, for when the ghosts they counted are cleared.
+	void clear_node_scopes()
+	{
+		for(uint32 i = 0; i < _scoped_node_ids.size(); i++)
+			_node_scopes[_scoped_node_ids[i]].node = NULL;
+		_scoped_node_ids.clear();
+		_node_scope_leaving.clear();
+		_node_scope_lost = false;
 	}
 	
 	/// Override to write ghost updates into each packet.
@@ -204,11 +431,12 @@ protected:
 		
 		for(int32 i = _ghost_zero_update_index - 1; i >= 0; i--)
 		{
-			if(!(_ghost_array[i]->flags & ghost_info::in_scope))
-				detach_object(_ghost_array[i]);
+			if(!is_ghost_in_scope(_ghost_array[i]))
+				leave_scope(_ghost_array[i]);
 		}
 		
 		uint32 max_index = 0;
+		_priority_ghosts.clear();
 		for(int32 i = _ghost_zero_update_index - 1; i >= 0; i--)
 		{
 			walk = _ghost_array[i];
@@ -228,17 +456,13 @@ protected:
 				if(walk->flags & ghost_info::kill_ghost)
 					walk->priority = 10000;
 				else
-					walk->priority = walk->obj->get_update_priority(_scope_object, walk->update_mask, walk->update_skip_count);
+					_priority_ghosts.push_back(walk);
 			}
 			else
 				walk->priority = 0;
 		}
+		compute_update_priorities(_priority_ghosts);
 		ghost_ref *update_list = NULL;
-		qsort(_ghost_array, _ghost_zero_update_index, sizeof(ghost_info *), compare_priority);
-		//quickSort(_ghost_array, _ghost_array + _ghost_zero_update_index, compare_priority);
-		// reset the array indices...
-		for(int32 i = _ghost_zero_update_index - 1; i >= 0; i--)
-			_ghost_array[i]->array_index = i;
 		
 		int32 send_size = 1;
 		while(max_index >>= 1)
@@ -247,19 +471,31 @@ protected:
 		if(send_size < 3)
 			send_size = 3;
 		
-		bstream.write_integer(send_size - 3, 3); // 0-7 3 bit number
+		bstream.write_integer(send_size - 3, ghost_id_size_bit_size); // ids of 3 to 18 bits
 		
 		uint32 count = 0;
-		// 
+		
+		// ghosts are written from the end of the array down.  Rather than sorting every dirty ghost, only as many as are
+		// likely to fit in the rest of the packet are selected and sorted at a time.  Updates written move ghosts out of
+		// the dirty range from above i, so the unwritten entries below i stay where the selection left them.
+		int32 selected_start = _ghost_zero_update_index;
 		for(int32 i = _ghost_zero_update_index - 1; i >= 0 && !bstream.is_full(); i--)
 		{
+			if(i < selected_start)
+			{
+				int32 batch = int32(bstream.get_bit_space_available() / _average_ghost_update_bits) + min_ghost_selection_batch;
+				selected_start = max(i + 1 - batch, 0);
+				select_highest_priority_ghosts(selected_start, i + 1);
+			}
 			ghost_info *walk = _ghost_array[i];
 			if(walk->flags & (ghost_info::killing_ghost | ghost_info::ghosting))
 				continue;
 			
 			uint32 update_start = bstream.get_bit_position();
-			uint32 update_mask = walk->update_mask;
-			uint32 returned_mask = 0;
+			connection_string_table::string_note *string_mark = get_string_table().get_sent_mark();
+			net_state_mask update_mask = walk->update_mask;
+			net_state_mask returned_mask = 0;
+			uint32 delta_update = 0;
 			
 			bstream.write_bool(true);
 			bstream.write_integer(walk->index, send_size);
@@ -282,11 +518,11 @@ protected:
 				
 				// write out the mask unless this is the first update (in which case the mask will be all dirty):
 				if(!is_initial_update)
-					bstream.write_integer(update_mask, type_rep->max_state_index);
+					write_state_mask(bstream, update_mask, type_rep->max_state_index);
 				// now loop through all the fields, and if it's in the update mask, blast it into the bit stream:
 
-				void *object_pointer = (void *) walk->obj;
-				returned_mask = write_object_update(bstream, object_pointer, type_rep, update_mask);
+				returned_mask = write_shared_object_update(bstream, walk->obj, type_rep, update_mask);
+				delta_update = write_delta_slots(bstream, walk, update_mask, _saved_delta_tag);
 
 				if(is_initial_update)
 				{
@@ -308,12 +544,16 @@ protected:
 			if(bstream.get_bit_space_available() < minimum_padding_bits)
 			{
 				bstream.set_bit_position(update_start);
+				get_string_table().rewind_sent_notes(string_mark);
+				if(delta_update)
+					walk->delta_state->restore_tag(_saved_delta_tag);
 				break;
 			}
+			_average_ghost_update_bits = (_average_ghost_update_bits * 7 + bstream.get_bit_position() - update_start) >> 3;
 			
 			// otherwise, create a record of this ghost update and
 			// attach it to the packet.
-			ghost_ref *upd = new ghost_ref;
+			ghost_ref *upd = alloc_ghost_ref();
 			
 			upd->next_ref = update_list;
 			update_list = upd;
@@ -325,6 +565,7 @@ protected:
 			upd->ghost = walk;
 			upd->ghost_info_flags = 0;
 			upd->update_chain = NULL;
+			upd->delta_update = delta_update;
 			
 			if(walk->flags & ghost_info::kill_ghost)
 			{
@@ -369,7 +610,7 @@ protected:
 			return;
 		
 		int32 id_size;
-		id_size = bstream.read_integer( 3 );
+		id_size = bstream.read_integer(ghost_id_size_bit_size);
 		id_size += 3;
 		
 		// while there's an object waiting...
@@ -380,6 +621,10 @@ protected:
 			bool is_initial_update = false;
 			//int32 start_position = bstream.getCurPos();
 			index = (uint32) bstream.read_integer(id_size);
+			if(index >= max_ghost_count)
+				throw tnl_exception_invalid_packet;
+			if(index >= _local_ghosts.size())
+				grow_local_ghosts(index);
 			if(bstream.read_bool()) // is this ghost being deleted?
 			{
 				assert(_local_ghosts[index] != NULL); // Error, NULL ghost encountered.
@@ -388,6 +633,8 @@ protected:
 					_local_ghosts[index]->on_ghost_remove();
 					delete _local_ghosts[index];
 					_local_ghosts[index] = NULL;
+					delete _local_delta_values[index];
+					_local_delta_values[index] = NULL;
 				}
 			}
 			else
@@ -420,11 +667,12 @@ protected:
 					_local_ghosts[index] = obj;
 					
 					is_initial_update = true;
-					read_object_update(bstream, object_pointer, type_rep, 0xFFFFFFFF);
+					read_object_update(bstream, object_pointer, type_rep, ~net_state_mask(0));
+					read_delta_slots(bstream, index, type_rep, ~net_state_mask(0));
 					
 					if(!obj->on_ghost_add(this))
 						throw tnl_exception_ghost_add_failed;
-					obj->on_ghost_update(0xFFFFFFFF);
+					obj->on_ghost_update(~net_state_mask(0));
 				}
 				else
 				{
@@ -432,8 +680,9 @@ protected:
 					type_database::type_rep *type_rep = _local_ghosts[index]->_type_rep;
 					ttr = type_rep;
 
-					uint32 update_mask = bstream.read_integer(type_rep->max_state_index);
+					net_state_mask update_mask = read_state_mask(bstream, type_rep->max_state_index);
 					read_object_update(bstream, object_pointer, type_rep, update_mask);
+					read_delta_slots(bstream, index, type_rep, update_mask);
 					_local_ghosts[index]->on_ghost_update(update_mask);
 				}
 				TorqueLogMessageFormatted(LogGhostConnection, ("ghost_connection %s read GHOST %d", ttr->name.c_str(), bstream.get_bit_position() - start_position));
@@ -441,54 +690,195 @@ protected:
 		}
 	}
 	
-	uint32 write_object_update(bit_stream &bstream, void *object_pointer, type_database::type_rep *type_rep, uint32 update_mask)
+	/// Writes the states of object in update_mask.  If the object is ghosted on other connections, the encoded update is cached on the object for the rest of the update tick, so connections writing the same update copy its bits rather than serializing it again.
+	net_state_mask write_shared_object_update(bit_stream &bstream, net_object *object, type_database::type_rep *type_rep, net_state_mask update_mask)
 	{
-		uint32 returned_mask = 0;
-		while(type_rep)
+		// only worth caching if another connection may send the same update, and string slots are encoded for this connection's string table
+		if(!object->_first_object_ref || !object->_first_object_ref->next_object_ref || (update_mask & get_field_table(type_rep)->string_state_mask))
+			return write_object_update(bstream, (void *) object, type_rep, update_mask);
+		
+		ghost_update_cache *cache = object->_update_cache;
+		uint32 tick = _interface->get_update_tick();
+		if(!cache)
+		{
+			cache = object->_update_cache = new ghost_update_cache;
+			cache->tick = 0;
+		}
+		if(cache->tick != tick)
+		{
+			cache->tick = tick;
+			cache->next_entry = 0;
+			for(uint32 i = 0; i < ghost_update_cache::entry_count; i++)
+				cache->entries[i].in_use = false;
+		}
+		for(uint32 i = 0; i < ghost_update_cache::entry_count; i++)
 		{
-			for(dictionary<type_database::field_rep>::pointer i = type_rep->fields.first(); i; ++i)
+			ghost_update_cache::entry &the_entry = cache->entries[i];
+			if(the_entry.in_use && the_entry.update_mask == update_mask && the_entry.type_rep == type_rep)
 			{
-				type_database::field_rep *field_rep = i.value();
-				uint32 state_mask = 1 << field_rep->state_index;
-				
-				if(update_mask & state_mask)
-				{
-					bool res;
-					void *field_ptr = (void *) ((uint8 *)object_pointer + field_rep->offset);
-					
-					if(field_rep->compound_type)
-						res = field_rep->compound_type->write(bstream, field_ptr);
-					else
-						res = field_rep->write_function(bstream, field_ptr);
-					if(!res)
-						returned_mask |= state_mask;					
-				}
+				bstream.write_bits(the_entry.bit_count, &the_entry.bits[0]);
+				return the_entry.returned_mask;
+			}
+		}
+		
+		// encode into the entry's buffer, growing it only when the update doesn't fit
+		ghost_update_cache::entry &the_entry = cache->entries[cache->next_entry];
+		the_entry.in_use = false;
+		if(!the_entry.bits.size())
+			the_entry.bits.resize(ghost_update_cache::initial_buffer_size);
+		net_state_mask returned_mask;
+		for(;;)
+		{
+			bit_stream stream(&the_entry.bits[0], the_entry.bits.size());
+			returned_mask = write_object_update(stream, (void *) object, type_rep, update_mask);
+			if(!stream.is_full())
+			{
+				the_entry.bit_count = stream.get_bit_position();
+				break;
 			}
-			type_rep = type_rep->parent_class;
+			// an update too big for a datagram can't be sent anyway; let the packet overrun check deal with it
+			if(the_entry.bits.size() >= net::udp_socket::max_datagram_size)
+				return write_object_update(bstream, (void *) object, type_rep, update_mask);
+			the_entry.bits.resize(min(the_entry.bits.size() * 2, uint32(net::udp_socket::max_datagram_size)));
 		}
+		
+		cache->next_entry = (cache->next_entry + 1) % ghost_update_cache::entry_count;
+		the_entry.in_use = true;
+		the_entry.update_mask = update_mask;
+		the_entry.returned_mask = returned_mask;
+		the_entry.type_rep = type_rep;
+		
+		bstream.write_bits(the_entry.bit_count, &the_entry.bits[0]);
 		return returned_mask;
 	}
 	
-	void read_object_update(bit_stream &bstream, void *object_pointer, type_database::type_rep *type_rep, uint32 update_mask)
+	/// Writes the delta slots of the ghost whose states are in update_mask, each as a difference from the most recent acknowledged value if that is smaller than the full value.  Returns the ghost_delta_state::update_count of the update, to be acked through its ghost_ref, or 0 if no delta slots were written.  The ghost's delta state for the update's tag is saved in saved first, to be restored if the update is rewound out of the packet.
+	uint32 write_delta_slots(bit_stream &bstream, ghost_info *ghost, net_state_mask update_mask, ghost_delta_state::saved_tag &saved)
 	{
-		while(type_rep)
+		delta_layout *layout = ghost->delta_slots;
+		if(!layout || !(update_mask & layout->state_mask))
+			return 0;
+		
+		ghost_delta_state *state = ghost->delta_state;
+		state->save_next_tag(saved);
+		uint32 update_id = ++state->update_count;
+		uint32 tag = update_id & (delta_tag_count - 1);
+		state->update_id[tag] = update_id;
+		state->acked[tag] = false;
+		state->sent_slots[tag] = 0;
+		bstream.write_integer(tag, delta_tag_bit_size);
+		
+		for(uint32 i = 0; i < layout->slots.size(); i++)
 		{
-			for(dictionary<type_database::field_rep>::pointer i = type_rep->fields.first(); i; ++i)
+			delta_slot &slot = layout->slots[i];
+			if(!(update_mask & (net_state_mask(1) << slot.state_index)))
+				continue;
+			uint32 value = slot.get((uint8 *) ghost->obj + slot.offset);
+			
+			int32 baseline = state->find_baseline(i);
+			uint32 delta = 0;
+			bool use_delta = false;
+			if(baseline != -1)
 			{
-				type_database::field_rep *field_rep = i.value();
-				uint32 state_mask = 1 << field_rep->state_index;
-				
-				if(update_mask & state_mask)
-				{
-					void *field_ptr = (void *) ((uint8 *)object_pointer + field_rep->offset);
-					if(field_rep->compound_type)
-						field_rep->compound_type->read(bstream, field_ptr);
-					else
-						field_rep->read_function(bstream, field_ptr);	
-				}
+				delta = zigzag_encode(int32(value - state->values[i * delta_tag_count + baseline]));
+				use_delta = get_delta_varint_size(delta) + delta_tag_bit_size < slot.bit_count;
 			}
-			type_rep = type_rep->parent_class;
+			if(bstream.write_bool(use_delta))
+			{
+				bstream.write_integer(baseline, delta_tag_bit_size);
+				write_delta_varint(bstream, delta);
+			}
+			else
+				bstream.write_integer(value, slot.bit_count);
+			
+			state->values[i * delta_tag_count + tag] = value;
+			state->sent_slots[tag] |= 1 << i;
 		}
+		return update_id;
+	}
+	
+	/// Reads the delta slots written by write_delta_slots() into the ghost at index, and records their values under the update's tag.
+	void read_delta_slots(bit_stream &bstream, uint32 index, type_database::type_rep *type_rep, net_state_mask update_mask)
+	{
+		delta_layout *layout = get_delta_slot_registry().get_layout(type_rep);
+		if(!layout || !(update_mask & layout->state_mask))
+			return;
+		
+		array<uint32> *values = _local_delta_values[index];
+		if(!values)
+		{
+			values = _local_delta_values[index] = new array<uint32>;
+			values->resize(layout->slots.size() * delta_tag_count);
+			for(uint32 i = 0; i < values->size(); i++)
+				(*values)[i] = 0;
+		}
+		
+		uint32 tag = bstream.read_integer(delta_tag_bit_size);
+		net_object *object = _local_ghosts[index];
+		for(uint32 i = 0; i < layout->slots.size(); i++)
+		{
+			delta_slot &slot = layout->slots[i];
+			if(!(update_mask & (net_state_mask(1) << slot.state_index)))
+				continue;
+			uint32 value;
+			if(bstream.read_bool())
+			{
+				uint32 baseline = bstream.read_integer(delta_tag_bit_size);
+				value = (*values)[i * delta_tag_count + baseline] + uint32(zigzag_decode(read_delta_varint(bstream)));
+			}
+			else
+				value = bstream.read_integer(slot.bit_count);
+			slot.set((uint8 *) object + slot.offset, value);
+			(*values)[i * delta_tag_count + tag] = value;
+		}
+	}
+	
+	net_state_mask write_object_update(bit_stream &bstream, void *object_pointer, type_database::type_rep *type_rep, net_state_mask update_mask)
+	{
+		return get_field_table(type_rep)->write(bstream, object_pointer, update_mask, &get_string_table());
+	}
+	
+	void read_object_update(bit_stream &bstream, void *object_pointer, type_database::type_rep *type_rep, net_state_mask update_mask)
+	{
+		get_field_table(type_rep)->read(bstream, object_pointer, update_mask, &get_string_table());
+	}
+	
+	/// Writes the low bit_count bits of mask.  bit_stream integers are at most 32 bits, so the masks of classes with more states are written in two parts.
+	static void write_state_mask(bit_stream &bstream, net_state_mask mask, uint32 bit_count)
+	{
+		if(bit_count <= 32)
+			bstream.write_integer(uint32(mask), bit_count);
+		else
+		{
+			bstream.write_integer(uint32(mask), 32);
+			bstream.write_integer(uint32(mask >> 32), bit_count - 32);
+		}
+	}
+	
+	static net_state_mask read_state_mask(bit_stream &bstream, uint32 bit_count)
+	{
+		if(bit_count <= 32)
+			return bstream.read_integer(bit_count);
+		net_state_mask mask = bstream.read_integer(32);
+		return mask | (net_state_mask(bstream.read_integer(bit_count - 32)) << 32);
+	}
+	
+	/// Returns the flattened field table of a ghostable class from the ghost_field_table_registry, remembering it by class index the first time the class is ghosted on this connection.
+	ghost_field_table *get_field_table(type_database::type_rep *type_rep)
+	{
+		uint32 class_index = type_rep->class_index;
+		if(class_index >= _field_tables.size())
+		{
+			uint32 old_size = _field_tables.size();
+			_field_tables.resize(class_index + 1);
+			for(uint32 i = old_size; i <= class_index; i++)
+				_field_tables[i] = NULL;
+		}
+		ghost_field_table *table = _field_tables[class_index];
+		if(!table)
+			table = _field_tables[class_index] = get_ghost_field_table_registry().get_table(type_rep);
+		assert(table->type_rep == type_rep);
+		return table;
 	}
 	
 	/// Override to check if there is data pending on this ghost_connection.
@@ -504,24 +894,44 @@ protected:
 	//----------------------------------------------------------------
 	
 protected:
-	/// Array of ghost_info structures used to track all the objects ghosted by this side of the connection. For efficiency, ghosts are stored in three segments - the first segment contains GhostInfos that have pending updates, the second ghostrefs that need no updating, and last, free GhostInfos that may be reused.
-	ghost_info **_ghost_array;
+	/// Array of ghost_info structures used to track all the objects ghosted by this side of the connection. For efficiency, ghosts are stored in three segments - the first segment contains GhostInfos that have pending updates, the second ghostrefs that need no updating, and last, free GhostInfos that may be reused.  The array grows by a block of free ghosts at a time, up to max_ghost_count.
+	array<ghost_info *> _ghost_array;
+	bool _ghost_from; ///< True if this side of the connection ghosts objects to the remote host.
 	
 	
 	int32 _ghost_zero_update_index; ///< Index in _ghost_array of first ghost with 0 update mask (ie, with no updates).
 	
 	int32 _ghost_free_index; ///< index in _ghost_array of first free ghost.
+	uint32 _average_ghost_update_bits; ///< Running average size of the ghost updates written, used to estimate how many dirty ghosts to select for each packet.
 	
 	bool _ghosting; ///< Am I currently ghosting objects over?
 	bool _scoping; ///< Am I currently allowing objects to be scoped?
 	uint32  _ghosting_sequence; ///< Sequence number describing this ghosting session.
 	
-	net_object **_local_ghosts; ///< Local ghost array for remote objects, or NULL if mGhostTo is false.
+	array<net_object *> _local_ghosts; ///< Local ghosts of remote objects, by ghost id.  Grows to the highest ghost id received.
+	bool _ghost_to; ///< True if the remote host is allowed to ghost objects to this side of the connection.
+	array<array<uint32> *> _local_delta_values; ///< Delta slot values received under each update tag for each local ghost with delta slots, parallel to _local_ghosts.
 	
-	ghost_info *_ghost_refs; ///< Allocated array of ghostInfos, or NULL if mGhostFrom is false.
-	ghost_info **_ghost_lookup_table; ///< Table indexed by object id->ghost_info, or NULL if mGhostFrom is false.
+	array<ghost_info *> _ghost_blocks; ///< Blocks of ghost_block_size ghost_infos, allocated as the number of ghosts in scope grows.  The ghost_info for ghost id i is in block i >> ghost_block_shift.
+	array<ghost_info *> _ghost_object_map; ///< The ghost_info of each object ghosted on this connection, indexed by the object's net_interface object id.
+	ghost_ref *_free_ghost_refs; ///< ghost_refs of notified packets, linked through next_ref, for reuse by write_packet() so that steady state ghosting doesn't allocate.
 	
 	safe_ptr<net_object> _scope_object;///< The local net_object that performs scoping queries to determine what objects to ghost to the client.
+	uint32 _scope_query_period; ///< Milliseconds between scope queries, or 0 to query on every packet unless a movement threshold is set.
+	float32 _scope_query_movement_threshold; ///< Distance the scope object moves before the scope query runs again, or 0.
+	bool _scope_query_pending; ///< True if the scope query must run before the next packet.
+	net::time _last_scope_query_time; ///< Time the scope query last ran.
+	float32 _last_scope_query_x, _last_scope_query_y; ///< Position of the scope object when the scope query last ran.
+	array<node_scope> _node_scopes; ///< Scope kept for each replication_node, by node id.
+	array<uint32> _scoped_node_ids; ///< Ids of the nodes included by the last query.
+	uint32 _node_scope_stamp; ///< Incremented by each query that scopes replication_nodes.
+	array<ghost_info *> _node_scope_leaving; ///< Ghosts whose objects were removed from their last included node during this query.
+	bool _node_scope_lost; ///< Set when a node's change log was outrun during a query, so the node counts must be rebuilt.
+	float32 _priority_inverse_radius_squared; ///< 1 / radius^2 for the distance priority radius set with set_priority_radius().
+	float32 _priority_skip_weight; ///< Distance priority added per skipped update.
+	array<ghost_info *> _priority_ghosts; ///< Ghosts whose priorities write_packet() is computing.
+	array<float32> _priority_x, _priority_y, _priority_skips, _priority_results; ///< Working arrays of compute_update_priorities(), kept to avoid reallocating them each packet.
+	ghost_delta_state::saved_tag _saved_delta_tag; ///< Delta state of the ghost update being written, for undoing it if the update is rewound.
 	
 	void clear_ghost_info()
 	{
@@ -534,30 +944,32 @@ protected:
 			while(del_walk)
 			{
 				ghost_ref *next = del_walk->next_ref;
-				delete del_walk;
+				free_ghost_ref(del_walk);
 				del_walk = next;
 			}
 		}
-		for(int32 i = 0; i < max_ghost_count; i++)
+		for(uint32 i = 0; i < _ghost_array.size(); i++)
 		{
-			if(_ghost_refs[i].array_index < _ghost_free_index)
+			ghost_info *info = get_ghost_info(i);
+			if(info->array_index < _ghost_free_index)
 			{
-				detach_object(&_ghost_refs[i]);
-				_ghost_refs[i].last_update_chain = NULL;
-				free_ghost_info(&_ghost_refs[i]);
+				detach_object(info);
+				info->last_update_chain = NULL;
+				free_ghost_info(info);
 			}
 		}
 		assert((_ghost_free_index == 0) && (_ghost_zero_update_index == 0));
+		clear_node_scopes();
 	}
 	
 	void delete_local_ghosts()
 	{
-		if(!_local_ghosts)
-			return;
 		// just delete all the local ghosts,
 		// and delete all the ghosts in the current save list
-		for(int32 i = 0; i < max_ghost_count; i++)
+		for(uint32 i = 0; i < _local_ghosts.size(); i++)
 		{
+			delete _local_delta_values[i];
+			_local_delta_values[i] = NULL;
 			if(_local_ghosts[i])
 			{
 				_local_ghosts[i]->on_ghost_remove();
@@ -572,7 +984,7 @@ protected:
 	bool validate_ghost_array()
 	{
 		assert(_ghost_zero_update_index >= 0 && _ghost_zero_update_index <= _ghost_free_index);
-		assert(_ghost_free_index <= max_ghost_count);
+		assert(_ghost_free_index <= int32(_ghost_array.size()));
 		int32 i;
 		for(i = 0; i < _ghost_zero_update_index; i ++)
 		{
@@ -584,13 +996,170 @@ protected:
 			assert(_ghost_array[i]->array_index == i);
 			assert(_ghost_array[i]->update_mask == 0);
 		}
-		for(; i < max_ghost_count; i++)
+		for(; i < int32(_ghost_array.size()); i++)
 		{
 			assert(_ghost_array[i]->array_index == i);
 		}
 		return true;
 	}
 	
+	/// Returns the ghost_info for a ghost id.
+	ghost_info *get_ghost_info(uint32 index)
+	{
+		return _ghost_blocks[index >> ghost_block_shift] + (index & (ghost_block_size - 1));
+	}
+	
+	/// Adds a block of free ghost_infos to the end of the ghost array.  Returns false if the ghost id space is already at max_ghost_count.
+	bool grow_ghost_space()
+	{
+		uint32 base = _ghost_array.size();
+		if(base >= max_ghost_count)
+			return false;
+		
+		ghost_info *block = new ghost_info[ghost_block_size];
+		_ghost_blocks.push_back(block);
+		for(uint32 i = 0; i < ghost_block_size; i++)
+		{
+			block[i].obj = NULL;
+			block[i].index = base + i;
+			block[i].update_mask = 0;
+			block[i].last_update_chain = NULL;
+			block[i].array_index = base + i;
+			block[i].delta_slots = NULL;
+			block[i].delta_state = NULL;
+			block[i].node_scope_count = 0;
+			_ghost_array.push_back(block + i);
+		}
+		return true;
+	}
+	
+	/// Returns the ghost_info of object on this connection, or NULL if it has none.
+	ghost_info *find_ghost_info(net_object *object)
+	{
+		// objects not yet ghosted from this interface have no object id
+		if(object->_interface != _interface || object->_object_id >= _ghost_object_map.size())
+			return NULL;
+		return _ghost_object_map[object->_object_id];
+	}
+	
+	/// Sets the priority of each of ghosts, which are in scope and out of date.  Objects with a priority position are prioritized together by compute_distance_priorities() if the scope object has a position, and the rest by their get_update_priority().  Override to compute the priorities of many ghosts at once by other rules.
+	virtual void compute_update_priorities(array<ghost_info *> &ghosts)
+	{
+		float32 scope_x, scope_y;
+		if(!_scope_object->get_scope_position(scope_x, scope_y))
+		{
+			for(uint32 i = 0; i < ghosts.size(); i++)
+				ghosts[i]->priority = ghosts[i]->obj->get_update_priority(_scope_object, ghosts[i]->update_mask, ghosts[i]->update_skip_count);
+			return;
+		}
+		
+		// gather the positioned objects into parallel arrays, so the kernel is a straight loop over floats
+		uint32 count = 0;
+		_priority_x.resize(ghosts.size());
+		_priority_y.resize(ghosts.size());
+		_priority_skips.resize(ghosts.size());
+		_priority_results.resize(ghosts.size());
+		for(uint32 i = 0; i < ghosts.size(); i++)
+		{
+			ghost_info *ghost = ghosts[i];
+			net_object *object = ghost->obj;
+			if(!object->_has_priority_position)
+			{
+				ghost->priority = object->get_update_priority(_scope_object, ghost->update_mask, ghost->update_skip_count);
+				continue;
+			}
+			ghosts[count] = ghost;
+			_priority_x[count] = object->_priority_x;
+			_priority_y[count] = object->_priority_y;
+			_priority_skips[count] = float32(ghost->update_skip_count);
+			count++;
+		}
+		if(!count)
+			return;
+		compute_distance_priorities(count, &_priority_x[0], &_priority_y[0], &_priority_skips[0], &_priority_results[0], scope_x, scope_y, _priority_inverse_radius_squared, _priority_skip_weight);
+		for(uint32 i = 0; i < count; i++)
+			ghosts[i]->priority = _priority_results[i];
+	}
+	
+	/// Computes the distance priority of count objects at (x[i], y[i]) that have skipped skips[i] updates, seen from (scope_x, scope_y):
+	///
+	///    priority = max(1 - distance^2 / radius^2, 0) + skips * skip_weight
+	///
+	/// so objects at the scope object have priority 1, falling to 0 at the priority radius, and each skipped update adds skip_weight.  When the program includes <xmmintrin.h> before tnl2.h on a target with SSE, objects are computed four at a time with SSE intrinsics; the remainder, and every object on other targets, are computed one at a time.
+	static void compute_distance_priorities(uint32 count, const float32 *x, const float32 *y, const float32 *skips, float32 *priority, float32 scope_x, float32 scope_y, float32 inverse_radius_squared, float32 skip_weight)
+	{
+		uint32 i = 0;
+#if defined(_MM_SHUFFLE) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+		__m128 scope_x4 = _mm_set1_ps(scope_x);
+		__m128 scope_y4 = _mm_set1_ps(scope_y);
+		__m128 inverse_radius_squared4 = _mm_set1_ps(inverse_radius_squared);
+		__m128 skip_weight4 = _mm_set1_ps(skip_weight);
+		__m128 one4 = _mm_set1_ps(1);
+		__m128 zero4 = _mm_setzero_ps();
+		for(; i + 4 <= count; i += 4)
+		{
+			__m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), scope_x4);
+			__m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), scope_y4);
+			__m128 distance_squared = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			__m128 closeness = _mm_sub_ps(one4, _mm_mul_ps(distance_squared, inverse_radius_squared4));
+			__m128 skip_priority = _mm_mul_ps(_mm_loadu_ps(skips + i), skip_weight4);
+			_mm_storeu_ps(priority + i, _mm_add_ps(_mm_max_ps(closeness, zero4), skip_priority));
+		}
+#endif
+		for(; i < count; i++)
+		{
+			float32 dx = x[i] - scope_x;
+			float32 dy = y[i] - scope_y;
+			float32 closeness = 1 - (dx * dx + dy * dy) * inverse_radius_squared;
+			priority[i] = max(closeness, float32(0)) + skips[i] * skip_weight;
+		}
+	}
+	
+	/// Returns a ghost_ref from the free list, or a new one if the list is empty.
+	ghost_ref *alloc_ghost_ref()
+	{
+		ghost_ref *ref = _free_ghost_refs;
+		if(!ref)
+			return new ghost_ref;
+		_free_ghost_refs = ref->next_ref;
+		return ref;
+	}
+	
+	/// Puts ref on the free list for reuse by a later packet.
+	void free_ghost_ref(ghost_ref *ref)
+	{
+		ref->next_ref = _free_ghost_refs;
+		_free_ghost_refs = ref;
+	}
+	
+	/// Grows _ghost_object_map so that object_id is a valid index.
+	void grow_ghost_object_map(uint32 object_id)
+	{
+		uint32 old_size = _ghost_object_map.size();
+		uint32 new_size = max(old_size * 2, uint32(ghost_block_size));
+		while(new_size <= object_id)
+			new_size *= 2;
+		_ghost_object_map.resize(new_size);
+		for(uint32 i = old_size; i < new_size; i++)
+			_ghost_object_map[i] = NULL;
+	}
+	
+	/// Grows the local ghost array so that index is a valid ghost id.
+	void grow_local_ghosts(uint32 index)
+	{
+		uint32 old_size = _local_ghosts.size();
+		uint32 new_size = max(old_size * 2, uint32(ghost_block_size));
+		while(new_size <= index)
+			new_size *= 2;
+		_local_ghosts.resize(new_size);
+		_local_delta_values.resize(new_size);
+		for(uint32 i = old_size; i < new_size; i++)
+		{
+			_local_ghosts[i] = NULL;
+			_local_delta_values[i] = NULL;
+		}
+	}
+	
 	void free_ghost_info(ghost_info *ghost)
 	{
 		assert(ghost->array_index < _ghost_free_index);
@@ -610,19 +1179,34 @@ protected:
 	/// Notifies subclasses that the server has stopped ghosting objects on this connection.
 	virtual void on_end_ghosting() {}
 	
+	/// Notifies subclasses that object has come into scope and will be ghosted to the remote host.
+	virtual void on_scope_enter(net_object *object) {}
+	
+	/// Notifies subclasses that object has left scope and its ghost will be removed from the remote host.  This isn't called for ghosts removed because their object was deleted or ghosting was reset.  Scope must not be changed from this callback.
+	virtual void on_scope_leave(net_object *object) {}
+	
 public:
 	ghost_connection(bool is_initiator = false) : event_connection(is_initiator)
 	{
 		// ghost management data:
 		_scope_object = NULL;
+		_scope_query_period = 0;
+		_scope_query_movement_threshold = 0;
+		_scope_query_pending = true;
+		_last_scope_query_x = _last_scope_query_y = 0;
+		_node_scope_stamp = 0;
+		_node_scope_lost = false;
+		_priority_inverse_radius_squared = 1;
+		_priority_skip_weight = 0.1f;
 		_ghosting_sequence = 0;
 		_ghosting = false;
 		_scoping = false;
-		_ghost_array = NULL;
-		_ghost_refs = NULL;
-		_ghost_lookup_table = NULL;
-		_local_ghosts = NULL;
+		_ghost_from = false;
+		_ghost_to = false;
 		_ghost_zero_update_index = 0;
+		_ghost_free_index = 0;
+		_free_ghost_refs = NULL;
+		_average_ghost_update_bits = 64;
 		register_rpc_methods();
 	}
 	
@@ -631,72 +1215,60 @@ public:
 		_clear_all_packet_notifies();
 		
 		// delete any ghosts that may exist for this connection, but aren't added
-		if(_ghost_array)
+		if(_ghost_from)
 			clear_ghost_info();
 		delete_local_ghosts();
-		delete[] _local_ghosts;
-		delete[] _ghost_lookup_table;
-		delete[] _ghost_refs;
-		delete[] _ghost_array;
+		clear_node_scopes();
+		for(uint32 i = 0; i < _ghost_array.size(); i++)
+			delete _ghost_array[i]->delta_state;
+		for(uint32 i = 0; i < _ghost_blocks.size(); i++)
+			delete[] _ghost_blocks[i];
+		while(_free_ghost_refs)
+			delete alloc_ghost_ref();
 	}
 	
-	/// Sets whether ghosts transmit from this side of the connection.
+	/// Sets whether ghosts transmit from this side of the connection.  The ghost tracking structures are allocated as objects come into scope.
 	void set_ghost_from(bool ghost_from)
 	{
-		if(_ghost_array)
+		if(_ghost_from)
 			return;
 		
 		if(ghost_from)
 		{
 			_ghost_free_index = _ghost_zero_update_index = 0;
-			_ghost_array = new ghost_info *[max_ghost_count];
-			_ghost_refs = new ghost_info[max_ghost_count];
-			int32 i;
-			for(i = 0; i < max_ghost_count; i++)
-			{
-				_ghost_refs[i].obj = NULL;
-				_ghost_refs[i].index = i;
-				_ghost_refs[i].update_mask = 0;
-			}
-			_ghost_lookup_table = new ghost_info *[ghost_lookup_table_size];
-			for(i = 0; i < ghost_lookup_table_size; i++)
-				_ghost_lookup_table[i] = 0;
+			_ghost_from = true;
 		}
 	}
 	
-	/// Sets whether ghosts are allowed from the other side of the connection.
+	/// Sets whether ghosts are allowed from the other side of the connection.  The local ghost array is grown as ghosts arrive.
 	void set_ghost_to(bool ghost_to)
 	{
-		if(_local_ghosts) // if ghosting to this is already enabled, silently return
+		if(_ghost_to) // if ghosting to this is already enabled, silently return
 			return;
-		
-		if(ghost_to)
-		{
-			_local_ghosts = new net_object *[max_ghost_count];
-			for(int32 i = 0; i < max_ghost_count; i++)
-				_local_ghosts[i] = NULL;
-		}
+		_ghost_to = ghost_to;
 	}
 	
 	
 	/// Does this ghost_connection ghost NetObjects to the remote host?
-	bool does_ghost_from() { return _ghost_array != NULL; } 
+	bool does_ghost_from() { return _ghost_from; } 
 	
 	/// Does this ghost_connection receive ghosts from the remote host?
-	bool does_ghost_to() { return _local_ghosts != NULL; }
+	bool does_ghost_to() { return _ghost_to; }
 	
 	/// Returns the sequence number of this ghosting session.
 	uint32 get_ghosting_sequence() { return _ghosting_sequence; }
 	
 	enum ghost_constants {
-		ghost_id_bit_size = 10, ///< Size, in bits, of the integer used to transmit ghost IDs
-		ghost_lookup_table_size_shift = 10, ///< The size of the hash table used to lookup source NetObjects by remote ghost ID is 1 << ghost_lookup_table_size_shift.
+		ghost_id_bit_size = 16, ///< Size, in bits, of the largest ghost ID
+		small_ghost_id_bit_size = 10, ///< Size, in bits, of ghost IDs written in the short form of write_ghost_index()
+		ghost_id_size_bit_size = 4, ///< Size, in bits, of the field giving the ID size of the ghost updates in a packet
 		
 		max_ghost_count = (1 << ghost_id_bit_size), ///< Maximum number of ghosts that can be active at any one time.
 		ghost_count_bit_size = ghost_id_bit_size + 1, ///< Size of the field needed to transmit the total number of ghosts.
 		
-		ghost_lookup_table_size = (1 << ghost_lookup_table_size_shift), ///< Size of the hash table used to lookup source NetObjects by remote ghost ID.
-		ghost_lookup_table_mask = (ghost_lookup_table_size - 1), ///< Hashing mask for table lookups.
+		ghost_block_shift = 8,
+		ghost_block_size = (1 << ghost_block_shift), ///< Number of ghost_infos allocated at a time as the ghost ID space grows.
+		min_ghost_selection_batch = 16, ///< Number of dirty ghosts selected beyond the estimate of how many updates fit in the packet.
 	};
 	
 	/// Sets the object that is queried at each packet to determine what NetObjects should be ghosted on this connection.
@@ -705,6 +1277,37 @@ public:
 		if(((net_object *) _scope_object) == object)
 			return;
 		_scope_object = object;
+		_scope_query_pending = true;
+	}
+	
+	/// Sets how often the scope query runs.  By default it runs before every packet; with a period, the in_scope state of each object persists between queries, and the query runs once period milliseconds have passed, when the scope object has moved further than the movement threshold, or after invalidate_scope().  A period of 0 with a movement threshold set runs the query only on movement or invalidation.
+	void set_scope_query_period(uint32 period)
+	{
+		_scope_query_period = period;
+	}
+	
+	/// Sets the distance from the scope object at which the distance priority of an object falls to zero.  See compute_distance_priorities().
+	void set_priority_radius(float32 radius)
+	{
+		_priority_inverse_radius_squared = 1 / (radius * radius);
+	}
+	
+	/// Sets how much each skipped update adds to the distance priority of an object.  See compute_distance_priorities().
+	void set_priority_skip_weight(float32 weight)
+	{
+		_priority_skip_weight = weight;
+	}
+	
+	/// Sets how far the scope object must move, by net_object::get_scope_position(), before the scope query runs again.  0 disables the movement check.
+	void set_scope_query_movement_threshold(float32 distance)
+	{
+		_scope_query_movement_threshold = distance;
+	}
+	
+	/// Forces the scope query to run before the next packet, for instance when the scope object's visibility rules change.
+	void invalidate_scope()
+	{
+		_scope_query_pending = true;
 	}
 	
 	
@@ -713,43 +1316,55 @@ public:
 	
 	/// Indicate that the specified object is currently in scope.  Method called by the scope object to indicate that the specified object is in scope.
 	void object_in_scope(net_object *object)
+	{
+		ghost_info *info = add_ghost(object);
+		if(info)
+			info->flags |= ghost_info::in_scope;
+	}
+	
+	/// Returns the ghost_info of object, creating it if the object isn't ghosted on this connection yet.  Returns NULL if scoping is off or the ghost id space is full.
+	ghost_info *add_ghost(net_object *object)
 	{
 		if (!_scoping || !does_ghost_from())
-			return;
+			return NULL;
 		
 		type_database::type_rep *type_rep = _type_database->find_type(object->get_type_record());
 						
 		assert(type_rep != 0);
-		assert(object->_interface == 0 || object->_interface == _interface);
-		
-		object->_interface = _interface;
+		_interface->register_object(object);
 						
-		int32 index = object->get_hash_id() & ghost_lookup_table_mask;
-		
 		// check if it's already in scope
-		// the object may have been cleared out without the lookupTable being cleared
-		// so validate that the object pointers are the same.
-		
-		for(ghost_info *walk = _ghost_lookup_table[index ]; walk; walk = walk->next_lookup_info)
-		{
-			if(walk->obj != object)
-				continue;
-			walk->flags |= ghost_info::in_scope;
-			return;
-		}
+		ghost_info *existing = find_ghost_info(object);
+		if(existing)
+			return existing;
 		
-		if (_ghost_free_index == max_ghost_count)
-			return;
+		if(_ghost_free_index == int32(_ghost_array.size()) && !grow_ghost_space())
+			return NULL;
 		
 		ghost_info *giptr = _ghost_array[_ghost_free_index];
 		ghost_push_free_to_zero(giptr);
-		giptr->update_mask = 0xFFFFFFFF;
+		giptr->update_mask = ~net_state_mask(0);
 		ghost_push_non_zero(giptr);
 		
-		giptr->flags = ghost_info::not_yet_ghosted | ghost_info::in_scope;
+		giptr->flags = ghost_info::not_yet_ghosted;
+		giptr->node_scope_count = 0;
 		
 		giptr->obj = object;
 		giptr->type_rep = type_rep;
+		giptr->delta_slots = get_delta_slot_registry().get_layout(type_rep);
+		if(giptr->delta_slots)
+		{
+			uint32 slot_count = giptr->delta_slots->slots.size();
+			if(giptr->delta_state && giptr->delta_state->values.size() != slot_count * delta_tag_count)
+			{
+				delete giptr->delta_state;
+				giptr->delta_state = NULL;
+			}
+			if(!giptr->delta_state)
+				giptr->delta_state = new ghost_delta_state(slot_count);
+			else
+				giptr->delta_state->reset();
+		}
 		
 		giptr->last_update_chain = NULL;
 		giptr->update_skip_count = 0;
@@ -762,24 +1377,109 @@ public:
 		giptr->prev_object_ref = NULL;
 		object->_first_object_ref = giptr;
 		
-		giptr->next_lookup_info = _ghost_lookup_table[index];
-		_ghost_lookup_table[index] = giptr;
+		if(object->_object_id >= _ghost_object_map.size())
+			grow_ghost_object_map(object->_object_id);
+		_ghost_object_map[object->_object_id] = giptr;
 		//assert(validate_ghost_array(), "Invalid ghost array!");
+		on_scope_enter(object);
+		return giptr;
+	}
+	
+	/// Indicate that the specified object is no longer in scope, without waiting for the next scope query.  With an infrequent scope query, scope logic that tracks its own changes can call object_in_scope() and object_out_of_scope() as objects enter and leave.  Objects marked with object_local_scope_always() or in a replication_node included by the scope query stay in scope.
+	void object_out_of_scope(net_object *object)
+	{
+		if(!_scoping || !does_ghost_from())
+			return;
+		ghost_info *info = find_ghost_info(object);
+		if(!info)
+			return;
+		info->flags &= ~ghost_info::in_scope;
+		if(!is_ghost_in_scope(info))
+			leave_scope(info);
+	}
+	
+	/// Includes the objects of node in scope for this query.  This is called by replication_graph::scope() from the scope query.  The connection keeps the node's objects in scope between queries and follows the node's changes, so including a node that hasn't changed since the last query costs the same however many objects it has.
+	void scope_node(replication_node *node)
+	{
+		if(!_scoping || !does_ghost_from())
+			return;
+		uint32 id = node->_node_id;
+		if(id >= _node_scopes.size())
+		{
+			uint32 old_size = _node_scopes.size();
+			_node_scopes.resize(id + 1);
+			for(uint32 i = old_size; i <= id; i++)
+				_node_scopes[i].stamp = 0;
+		}
+		node_scope &record = _node_scopes[id];
+		if(record.node.is_valid() && record.stamp == _node_scope_stamp)
+			return;
+		record.stamp = _node_scope_stamp;
+		if(record.node.is_null())
+		{
+			// newly included: every object in the node comes into scope
+			record.node = node;
+			record.version = node->_version;
+			_scoped_node_ids.push_back(id);
+			for(uint32 i = 0; i < node->_objects.size(); i++)
+				add_node_scope(node->_objects[i]);
+			return;
+		}
+		sync_node_scope(record);
 	}
 	
+protected:
+	/// Starts a scope query's scoping of replication_nodes.
+	void begin_node_scope()
+	{
+		_node_scope_stamp++;
+	}
+	
+	/// Ends a scope query's scoping of replication_nodes: drops the nodes included by the last query but not by this one, and takes the objects that are no longer in any included node out of scope.
+	void end_node_scope()
+	{
+		for(uint32 i = 0; i < _scoped_node_ids.size(); )
+		{
+			node_scope &record = _node_scopes[_scoped_node_ids[i]];
+			if(record.stamp == _node_scope_stamp)
+			{
+				i++;
+				continue;
+			}
+			sync_node_scope(record);
+			if(!_node_scope_lost)
+			{
+				replication_node *node = record.node;
+				for(uint32 j = 0; j < node->_objects.size(); j++)
+					remove_node_scope(node->_objects[j]);
+			}
+			record.node = NULL;
+			_scoped_node_ids.erase_unstable(i);
+		}
+		if(_node_scope_lost)
+			recount_node_scopes();
+		
+		// objects that moved between included nodes were removed from one and added to another, so they only leave scope if they are still out of it now
+		for(uint32 i = 0; i < _node_scope_leaving.size(); i++)
+		{
+			ghost_info *info = _node_scope_leaving[i];
+			if(info->obj && !is_ghost_in_scope(info))
+				leave_scope(info);
+		}
+		_node_scope_leaving.clear();
+	}
+public:
+	
+	
 	/// The specified object should be always in scope for this connection.
 	void object_local_scope_always(net_object *obj)
 	{
 		if(!does_ghost_from())
 			return;
 		object_in_scope(obj);
-		for(ghost_info *walk = _ghost_lookup_table[obj->get_hash_id() & ghost_lookup_table_mask]; walk; walk = walk->next_lookup_info)
-		{
-			if(walk->obj != obj)
-				continue;
-			walk->flags |= ghost_info::scope_local_always;
-			return;
-		}
+		ghost_info *info = find_ghost_info(obj);
+		if(info)
+			info->flags |= ghost_info::scope_local_always;
 	}
 	
 	/// The specified object should not be always in scope for this connection.
@@ -787,20 +1487,16 @@ public:
 	{
 		if(!does_ghost_from())
 			return;
-		for(ghost_info *walk = _ghost_lookup_table[object->get_hash_id() & ghost_lookup_table_mask]; walk; walk = walk->next_lookup_info)
-		{
-			if(walk->obj != object)
-				continue;
-			walk->flags &= ~ghost_info::scope_local_always;
-			return;
-		}
+		ghost_info *info = find_ghost_info(object);
+		if(info)
+			info->flags &= ~ghost_info::scope_local_always;
 	}
 	
 	
 	/// Given an object's ghost id, returns the ghost of the object (on the client side).
 	net_object *resolve_ghost(int32 id)
 	{
-		if(id == -1)
+		if(id < 0 || uint32(id) >= _local_ghosts.size())
 			return NULL;
 		
 		return _local_ghosts[id];
@@ -810,7 +1506,9 @@ public:
 	/// Given an object's ghost id, returns the source object (on the server side).
 	net_object *resolve_ghost_parent(int32 id)
 	{
-		return _ghost_refs[id].obj;
+		if(id < 0 || uint32(id) >= _ghost_array.size())
+			return NULL;
+		return get_ghost_info(id)->obj;
 	}
 	
 	/// Moves the specified ghost_info into the range of the ghost array for non-zero updateMasks.
@@ -884,13 +1582,9 @@ public:
 			return -1;
 		if(!does_ghost_from())
 			return object->_remote_index;
-		int32 index = object->get_hash_id() & ghost_lookup_table_mask;
-		
-		for(ghost_info *gptr = _ghost_lookup_table[index]; gptr; gptr = gptr->next_lookup_info)
-		{
-			if(gptr->obj == object && (gptr->flags & (ghost_info::killing_ghost | ghost_info::ghosting | ghost_info::not_yet_ghosted | ghost_info::kill_ghost)) == 0)
-				return gptr->index;
-		}
+		ghost_info *gptr = find_ghost_info(object);
+		if(gptr && (gptr->flags & ghost_info::not_available) == 0)
+			return gptr->index;
 		return -1;
 	}
 	
@@ -928,13 +1622,13 @@ public:
 		// iterate through the ghost always objects and in_scope them...
 		// also post em all to the other side.
 		
-		int32 j;
-		for(j = 0; j < max_ghost_count; j++)
+		for(uint32 j = 0; j < _ghost_array.size(); j++)
 		{
-			_ghost_array[j] = _ghost_refs + j;
+			_ghost_array[j] = get_ghost_info(j);
 			_ghost_array[j]->array_index = j;
 		}
 		_scoping = true; // so that object_in_scope will work
+		_scope_query_pending = true;
 		
 		rpc(&ghost_connection::rpc_start_ghosting, _ghosting_sequence);
 		//assert(validate_ghost_array(), "Invalid ghost array!");
@@ -951,7 +1645,7 @@ public:
 		// if the mask is in the zero range, we've got to move it up...
 		if(!info->update_mask)
 		{
-			info->update_mask = 0xFFFFFFFF;
+			info->update_mask = ~net_state_mask(0);
 			ghost_push_non_zero(info);
 		}
 		if(info->obj)
@@ -962,18 +1656,8 @@ public:
 				info->obj->_first_object_ref = info->next_object_ref;
 			if(info->next_object_ref)
 				info->next_object_ref->prev_object_ref = info->prev_object_ref;
-			// remove it from the lookup table
-			
-			uint32 id = info->obj->get_hash_id();
-			for(ghost_info **walk = &_ghost_lookup_table[id & ghost_lookup_table_mask]; *walk; walk = &((*walk)->next_lookup_info))
-			{
-				ghost_info *temp = *walk;
-				if(temp == info)
-				{
-					*walk = temp->next_lookup_info;
-					break;
-				}
-			}
+			// remove it from the object id map
+			_ghost_object_map[info->obj->_object_id] = NULL;
 			info->prev_object_ref = info->next_object_ref = NULL;
 			info->obj = NULL;
 		}
@@ -1018,31 +1702,51 @@ public:
 		register_rpc(&ghost_connection::rpc_start_ghosting, rpc_guaranteed_ordered, rpc_bidirectional);
 	}
 
-	/*/// Internal method called by net_object RPC events when they are packed.
-	void postRPCEvent(NetObjectRPCEvent *theEvent)
+	/// Posts an object RPC to every connection that the ghost of object is available on.  Called by net_object::ghost_rpc().
+	static void post_ghost_rpc(net_object *object, rpc_broadcast *the_broadcast)
 	{
-		RefPtr<NetObjectRPCEvent> event = theEvent;
-		
-		Assert((!is_ghost() && theEvent->mRPCDirection == RPCToGhost) ||
-			   (is_ghost() && theEvent->mRPCDirection == RPCToGhostParent),
-			   "Invalid RPC call - going in the wrong direction!");
-		
-		// ok, see what kind of an ref_object this is:
-		if(is_ghost())
-			_owning_connection->postNetEvent(theEvent);
-		else if(net_object::getRPCDestConnection())
+		for(ghost_info *walk = object->_first_object_ref; walk; walk = walk->next_object_ref)
 		{
-			net_object::getRPCDestConnection()->postNetEvent(theEvent);
+			if(!(walk->flags & ghost_info::not_available))
+				walk->connection->post_object_rpc(the_broadcast, object);
 		}
+	}
+	
+	/// Object RPC targets are written as the ghost index of the object on the remote host.
+	bool write_rpc_target(bit_stream &bstream, net_object *target)
+	{
+		if(!does_ghost_from())
+			return false;
+		int32 index = get_ghost_index(target);
+		if(index == -1)
+			return false;
+		write_ghost_index(bstream, index);
+		return true;
+	}
+	
+	/// Writes a ghost id outside of the ghost update section of a packet, in small_ghost_id_bit_size bits if it fits, or else in ghost_id_bit_size bits.
+	static void write_ghost_index(bit_stream &bstream, uint32 index)
+	{
+		if(bstream.write_bool(index < (1 << small_ghost_id_bit_size)))
+			bstream.write_integer(index, small_ghost_id_bit_size);
 		else
-		{
-			for(ghost_info *walk = _first_object_ref; walk; walk = walk->next_object_ref)
-			{
-				if(!(walk->flags & ghost_info::NotAvailable))
-					walk->connection->postNetEvent(theEvent);
-			}
-		}
-	}*/
+			bstream.write_integer(index, ghost_id_bit_size);
+	}
+	
+	/// Reads a ghost id written with write_ghost_index().
+	static uint32 read_ghost_index(bit_stream &bstream)
+	{
+		return bstream.read_integer(bstream.read_bool() ? small_ghost_id_bit_size : ghost_id_bit_size);
+	}
+	
+	/// Resolves the ghost index of an object RPC target to the local ghost.
+	net_object *read_rpc_target(bit_stream &bstream)
+	{
+		if(!does_ghost_to())
+			throw tnl_exception_illegal_rpc;
+		uint32 index = read_ghost_index(bstream);
+		return index < _local_ghosts.size() ? _local_ghosts[index] : NULL;
+	}
 };
 
 //----------------------------------------------------------------------------
@@ -1054,7 +1758,7 @@ struct ghost_info
 	// if the size of this structure changes, the NetConnection::get_ghost_index function MUST be changed to reflect.
 
 	net_object *obj; ///< The real object on the server.
-	uint32 update_mask; ///< The current out-of-date state mask for the object for this connection.
+	net_state_mask update_mask; ///< The current out-of-date state mask for the object for this connection.
 	ghost_connection::ghost_ref *last_update_chain; ///< The ghost_ref for this object in the last packet it was updated in,
 	///   or NULL if that last packet has been notified yet.
 	ghost_info *next_object_ref;  ///< Next ghost_info for this object in the doubly linked list of GhostInfos across
@@ -1063,14 +1767,16 @@ struct ghost_info
 	///  all connections that scope this object
 
 	ghost_connection *connection; ///< The connection that owns this ghost_info
-	ghost_info *next_lookup_info;   ///< Next ghost_info in the hash table for net_object*->ghost_info*
 	uint32 update_skip_count;         ///< How many times this object has NOT been updated in write_packet
+	uint32 node_scope_count; ///< Number of the replication_nodes included by the connection's last scope query that contain the object.
 
 	uint32 flags; ///< Current flag status of this object for this connection.
 	float32 priority; ///< Priority for the update of this object, computed after the scoping process has run.
-	uint16 index; ///< Fixed index of the object in the _ghost_refs array for the connection, and the ghostId of the object on the client.
-	int16 array_index; ///< Position of the object in the _ghost_array for the connection, which changes as the object is pushed to zero, non-zero and free.
+	uint32 index; ///< Fixed index of the ghost_info in the connection's ghost blocks, and the ghostId of the object on the client.
+	int32 array_index; ///< Position of the object in the _ghost_array for the connection, which changes as the object is pushed to zero, non-zero and free.
 	type_database::type_rep *type_rep; ///< type descriptor for this object
+	delta_layout *delta_slots; ///< delta slots of the object's class, or NULL if it has none
+	ghost_delta_state *delta_state; ///< values sent and acknowledged for the delta slots, allocated the first time the ghost_info is used for an object with delta slots
 
 	enum Flags
 	{
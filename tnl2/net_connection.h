@@ -122,7 +122,9 @@ public:
 		{
 			packet_dropped(note);
 		}
-		delete note;
+		// the notify is reused for a later packet, whose write_packet() overwrites it
+		note->next_packet = _free_notifies;
+		_free_notifies = note;
 	}
 	
 	torque_connection_id get_torque_connection()
@@ -160,29 +162,38 @@ public:
 	///       @endcode
 	virtual bool is_data_to_transmit() { return false; }
 	
+	/// Called each time the connection checks whether to send a packet, before is_data_to_transmit().  Subclasses can override this to do periodic processing, like timing out requests, at the packet send rate.
+	virtual void on_check_packet_send(net::time current_time) {}
+	
 	/// Checks to see if a packet should be sent at the currentTime to the remote host.
 	///
-	/// If force is true and there is space in the window, it will always send a packet.
-	void check_packet_send(bool force, net::time current_time)
+	/// If force is true and there is space in the window, it will always send a packet.  The packet is at most packet_size bytes, or the current packet send size if packet_size is 0.  Returns true if a packet was sent.
+	bool check_packet_send(bool force, net::time current_time, uint32 packet_size = 0)
 	{
+		on_check_packet_send(current_time);
 		if(window_full() || !is_data_to_transmit())
-			return;
+			return false;
 		net::time delay = net::time( _current_packet_send_period );
 		
 		if(!force)
 		{
 			if(current_time - _last_update_time + _send_delay_credit < delay)
-				return;
+				return false;
 			
 			_send_delay_credit = current_time - (_last_update_time + delay - _send_delay_credit);
 			if(_send_delay_credit > net::time(1000))
 				_send_delay_credit = net::time(1000);
 		}
+		_urgent_send_pending = false;
 		prepare_write_packet();
-		net::packet_stream stream(_current_packet_send_size);
+		net::packet_stream stream(packet_size ? packet_size : _current_packet_send_size);
 		_last_update_time = current_time;
 		
-		packet_notify *note = alloc_notify();
+		packet_notify *note = _free_notifies;
+		if(note)
+			_free_notifies = note->next_packet;
+		else
+			note = alloc_notify();
 
 		if(!_notify_queue_head)
 			_notify_queue_head = note;
@@ -202,13 +213,53 @@ public:
 			send_delay = net::time(2047);
 		stream.write_integer(uint32(send_delay.get_milliseconds() >> 3), 8);
 		write_packet(stream, note);
+		write_packet_tail(stream, note);
 
 		TorqueLogMessageFormatted(LogNetConnection, ("connection %d: END - %llu bits", _connection, stream.get_bit_position() - start) );
 		logprintf("NC packet write data: %s", net::buffer_encode_base_16(stream.get_buffer(), stream.get_next_byte_position())->get_buffer());
 
+		// every packet, regular or urgent, is paid for from the send token bucket
+		refill_send_tokens(current_time);
+		_send_tokens -= int32(stream.get_next_byte_position());
+		if(_send_tokens < -int32(_current_packet_send_size))
+			_send_tokens = -int32(_current_packet_send_size);
+
 		_last_send_sequence = _interface->get_socket_interface()->send_to_connection(_interface->get_socket(), _connection, stream.get_next_byte_position(), stream.get_buffer());
 		//torque_connection_send_to(_connection, stream.get_next_byte_position(), stream.get_buffer(), &_last_send_sequence);
 		_notify_queue_tail->sequence = _last_send_sequence;
+		return true;
+	}
+
+	/// Asks for a packet to be sent as soon as possible, rather than at the next regular send period.  The packet is sent by check_urgent_send().
+	void request_urgent_send()
+	{
+		_urgent_send_pending = true;
+	}
+	
+	/// Sends a packet right away if an urgent send was requested, there is space in the packet window, and the send token bucket has saved up at least min_urgent_packet_size bytes of the negotiated bandwidth.  The packet is limited to the bytes saved up, so urgent packets never spend bandwidth that hasn't been earned, and a connection that just sent a full regular packet can send a small urgent one as soon as the bucket refills that far.  Otherwise the request stays pending until the next check or the next regular send.  Returns true if a packet was sent.
+	bool check_urgent_send(net::time current_time)
+	{
+		if(!_urgent_send_pending)
+			return false;
+		refill_send_tokens(current_time);
+		if(window_full() || _send_tokens < int32(min(uint32(min_urgent_packet_size), _current_packet_send_size)))
+			return false;
+		bool sent = check_packet_send(true, current_time, min(uint32(_send_tokens), _current_packet_send_size));
+		// with nothing to transmit there is nothing urgent left to send
+		_urgent_send_pending = false;
+		return sent;
+	}
+	
+	/// Adds the bandwidth earned since the last refill to the send token bucket.  The bucket holds at most one full packet, and regular sends spend from it as well, so urgent packets, which only spend what is saved up, can't burst above the negotiated rate.
+	void refill_send_tokens(net::time current_time)
+	{
+		net::time elapsed = current_time - _last_token_refill_time;
+		if(elapsed > net::time(1000))
+			elapsed = net::time(1000);
+		_last_token_refill_time = current_time;
+		_send_tokens += int32(uint32(elapsed.get_milliseconds()) * _current_send_bandwidth / 1000);
+		if(_send_tokens > int32(_current_packet_send_size))
+			_send_tokens = int32(_current_packet_send_size);
 	}
 
 	virtual void on_packet(uint32 sequence, bit_stream &data)
@@ -218,6 +269,7 @@ public:
 		_last_packet_recv_time = _interface->get_process_start_time();
 		logprintf("NC packet read data: %s", net::buffer_encode_base_16(data.get_buffer(), data.get_next_byte_position())->get_buffer());
 		read_packet(data);
+		read_packet_tail(data);
 	}
 
 	/// Called to prepare the connection for packet writing.
@@ -233,7 +285,13 @@ public:
 	/// Called to read a subclass's packet data from the packet.
 	virtual void read_packet(bit_stream &bstream) {}	
 	
-	/// Allocates a data record to track data sent on an individual packet.  If you need to track additional notification information, you'll have to override this so you allocate a subclass of packet_notify with extra fields.
+	/// Called after write_packet to fill whatever space is left in the packet with low priority data.  Anything written here only uses space that write_packet of every subclass has already declined.
+	virtual void write_packet_tail(bit_stream &bstream, packet_notify *note) {}
+	
+	/// Called after read_packet to read the data written by write_packet_tail.
+	virtual void read_packet_tail(bit_stream &bstream) {}
+	
+	/// Allocates a data record to track data sent on an individual packet.  If you need to track additional notification information, you'll have to override this so you allocate a subclass of packet_notify with extra fields.  Notifies are reused once their packet has been notified, so write_packet() must set every field it adds rather than assume it was constructed.
 	virtual packet_notify *alloc_notify() { return new packet_notify; }
 	
 	/// sets the fixed rate send and receive data sizes, and sets the connection to not behave as an adaptive rate connection
@@ -293,6 +351,7 @@ public:
 		_current_packet_send_period = max(_local_rate.min_packet_send_period, _remote_rate.min_packet_recv_period);
 		
 		uint32 max_bandwidth = min(_local_rate.max_send_bandwidth, _remote_rate.max_recv_bandwidth);
+		_current_send_bandwidth = max_bandwidth;
 		_current_packet_send_size = uint32(max_bandwidth * _current_packet_send_period * 0.001f);
 		
 		// make sure we don't try to overwrite the maximum packet size
@@ -336,6 +395,7 @@ public:
 		_send_delay_credit = time(0);
 		_last_update_time = time(0);
 		_notify_queue_head = _notify_queue_tail = 0;
+		_free_notifies = 0;
 		_local_rate.max_recv_bandwidth = default_fixed_bandwidth;
 		_local_rate.max_send_bandwidth = default_fixed_bandwidth;
 		_local_rate.min_packet_recv_period = default_fixed_send_period;
@@ -346,6 +406,19 @@ public:
 		compute_negotiated_rate();
 		_last_send_sequence = 0;
 		_state = state_start;
+		_urgent_send_pending = false;
+		_send_tokens = 0;
+		_last_token_refill_time = time(0);
+	}
+	
+	/// Closes the connection from this side, sending reason to the remote host.  The connection stops sending and processing packets immediately, and is released by its interface the next time the interface processes its connections.
+	void disconnect(uint32 reason_size = 0, uint8 *reason = NULL)
+	{
+		if(_state == state_disconnected)
+			return;
+		_interface->get_socket_interface()->close_connection(_interface->get_socket(), _connection, reason_size, reason);
+		set_connection_state(state_disconnected);
+		_interface->_queue_connection_removal(_connection);
 	}
 	
 	void set_interface(net_interface *interface)
@@ -361,6 +434,12 @@ public:
 	{
 		_clear_all_packet_notifies();
 		assert(_notify_queue_head == NULL);
+		while(_free_notifies)
+		{
+			packet_notify *next = _free_notifies->next_packet;
+			delete _free_notifies;
+			_free_notifies = next;
+		}
 	}
 protected:
 	enum rate_defaults {
@@ -371,6 +450,7 @@ protected:
 	};
 	enum {
 		minimum_padding_bits = 32, ///< ask subclasses to reserve at least this much.
+		min_urgent_packet_size = 64, ///< Bytes of bandwidth the send token bucket must have saved up before an urgent packet is sent.
 	};
 	
 	bool _is_initiator;
@@ -380,9 +460,15 @@ protected:
 	bool _local_rate_changed; ///< Set to true when the local connection's rate has changed.
 	uint32 _current_packet_send_size; ///< Current size of each packet sent to the remote host.
 	uint32 _current_packet_send_period; ///< Millisecond delay between sent packets.
+	uint32 _current_send_bandwidth; ///< Negotiated number of bytes per second that can be sent to the remote host.
+	
+	bool _urgent_send_pending; ///< True if request_urgent_send() was called since the last packet was sent.
+	int32 _send_tokens; ///< Bytes of bandwidth saved up in the send token bucket; negative after sends that outpaced the negotiated rate.
+	net::time _last_token_refill_time; ///< Time the send token bucket was last refilled.
 	
 	packet_notify *_notify_queue_head; ///< Linked list of structures representing the data in sent packets
 	packet_notify *_notify_queue_tail; ///< Tail of the notify queue linked list.  New packets are added to the end of the tail.
+	packet_notify *_free_notifies; ///< Notifies of packets that have been notified, linked through next_packet, for reuse by later packets.
 	
 	torque_connection_id _connection;
 	net::time _last_packet_recv_time; ///< time of the receipt of the last data packet.
@@ -12,6 +12,16 @@ class net_interface : public ref_object
 		uint32 identifier;
 		type_record *type;
 	};
+	/// deferred_rpc is an RPC decoded while deferred dispatch is enabled, waiting for dispatch_deferred_rpcs().
+	struct deferred_rpc
+	{
+		ref_ptr<net_connection> connection; ///< the event_connection the call was received on
+		ref_ptr<rpc_functor> rpc; ///< the decoded call
+		uint32 rpc_index; ///< index of the method in the connection's rpc table
+		safe_ptr<net_object> target; ///< the object an object RPC is called on
+		uint32 method_hash; ///< hash of the method called, used to group calls to the same method
+		bool is_ordered; ///< true if the call was rpc_guaranteed_ordered, and must be dispatched in arrival order
+	};
 	
 public:
 	torque_socket_interface *get_socket_interface()
@@ -79,6 +89,8 @@ public:
 					break;
 			}
 		}
+		_remove_pending_connections();
+		check_for_urgent_sends();
 	}
 	template<class connection_type> void add_connection_type(uint32 identifier)
 	{
@@ -119,7 +131,7 @@ public:
 		for(net_object *obj = _dirty_list_head._next_dirty_list; obj != &_dirty_list_tail; )
 		{
 			net_object *next = obj->_next_dirty_list;
-			uint32 or_mask = obj->_dirty_mask_bits;
+			net_state_mask or_mask = obj->_dirty_mask_bits;
 			
 			obj->_next_dirty_list = NULL;
 			obj->_prev_dirty_list = NULL;
@@ -153,13 +165,99 @@ public:
 		obj->_prev_dirty_list = &_dirty_list_head;
 	}
 	
+	/// Sets whether RPCs received by this interface's event_connections are dispatched as soon as their packet is read, or queued until the next call to dispatch_deferred_rpcs().
+	void set_deferred_rpc_dispatch(bool deferred)
+	{
+		if(!deferred)
+			dispatch_deferred_rpcs();
+		_defer_rpc_dispatch = deferred;
+	}
+	
+	bool is_rpc_dispatch_deferred()
+	{
+		return _defer_rpc_dispatch;
+	}
+	
+	/// Queues a decoded RPC for dispatch_deferred_rpcs().
+	void defer_rpc(net_connection *the_connection, rpc_functor *the_rpc, uint32 rpc_index, uint32 method_hash, bool is_ordered, net_object *target)
+	{
+		deferred_rpc entry;
+		entry.connection = the_connection;
+		entry.rpc = the_rpc;
+		entry.rpc_index = rpc_index;
+		entry.target = target;
+		entry.method_hash = method_hash;
+		entry.is_ordered = is_ordered;
+		_deferred_rpcs.push_back(entry);
+	}
+	
+	/// Dispatches all RPCs received since the last call.  Unordered calls are dispatched first, grouped by method so that each handler runs as a batch; rpc_guaranteed_ordered calls are then dispatched in the order they were received.  Calls for connections that are no longer established are discarded.  The queue is taken before any handler runs, so calls queued by a handler, or by a nested call to dispatch_deferred_rpcs(), wait for the next call.
+	void dispatch_deferred_rpcs()
+	{
+		if(!_deferred_rpcs.size())
+			return;
+		
+		array<deferred_rpc> rpcs;
+		for(uint32 i = 0; i < _deferred_rpcs.size(); i++)
+			rpcs.push_back(_deferred_rpcs[i]);
+		_deferred_rpcs.clear();
+		
+		array<deferred_rpc *> batch;
+		for(uint32 i = 0; i < rpcs.size(); i++)
+			if(!rpcs[i].is_ordered)
+				batch.push_back(&rpcs[i]);
+		if(batch.size())
+		{
+			qsort(&batch[0], batch.size(), sizeof(deferred_rpc *), compare_deferred_rpcs);
+			for(uint32 i = 0; i < batch.size(); i++)
+				_dispatch_deferred_rpc(*batch[i]);
+		}
+		for(uint32 i = 0; i < rpcs.size(); i++)
+			if(rpcs[i].is_ordered)
+				_dispatch_deferred_rpc(rpcs[i]);
+	}
+	
 	net::time get_process_start_time()
 	{
 		return _process_start_time;
 	}
+	/// Returns the current update tick, which advances each time the interface checks its connections for packet sends.  Encoded ghost updates are shared between connections within a tick.
+	uint32 get_update_tick()
+	{
+		return _update_tick;
+	}
+	/// Makes object visible to this interface, and assigns it an object id, reusing the ids of destroyed objects.  Object ids are compact, so connections can look up their ghost_info for an object by indexing rather than hashing.
+	void register_object(net_object *object)
+	{
+		if(object->_interface)
+		{
+			assert(object->_interface == this);
+			return;
+		}
+		object->_interface = this;
+		if(_free_object_ids.size())
+		{
+			object->_object_id = _free_object_ids[_free_object_ids.size() - 1];
+			_free_object_ids.pop_back();
+		}
+		else
+		{
+			object->_object_id = _registered_objects.size();
+			_registered_objects.push_back(NULL);
+		}
+		_registered_objects[object->_object_id] = object;
+	}
+	
+	/// Returns one more than the highest object id assigned so far.
+	uint32 get_object_id_count()
+	{
+		return _registered_objects.size();
+	}
+	
 	void check_for_packet_sends()
 	{
 		_process_start_time = net::time::get_current();
+		_update_tick++;
 		collapse_dirty_list();
 		for(uint32 i = 0; i < _connection_table.size(); i++)
 		{
@@ -167,14 +265,76 @@ public:
 			if(the_connection->get_connection_state() == net_connection::state_established)
 				the_connection->check_packet_send(false, get_process_start_time());
 		}
+		_remove_pending_connections();
 	}
-		
+	
+	/// Sends packets right away on connections that have urgent RPCs waiting, instead of waiting for their next regular send.  This is called after processing incoming socket events, so that calls made in response to received packets go out immediately; it can also be called after posting urgent calls from elsewhere.
+	void check_for_urgent_sends()
+	{
+		_process_start_time = net::time::get_current();
+		for(uint32 i = 0; i < _connection_table.size(); i++)
+		{
+			net_connection *the_connection = *_connection_table[i].value();
+			if(the_connection->get_connection_state() == net_connection::state_established)
+				the_connection->check_urgent_send(get_process_start_time());
+		}
+		_remove_pending_connections();
+	}
+
+	/// Sends an RPC to every established connection of class T (or a subclass of it).  The call's arguments are serialized once and the resulting bits are shared by all of the connections' send queues.
+	template <class T> void broadcast_rpc(void (T::*method)())
+	{
+		ref_ptr<event_connection::rpc_broadcast> the_broadcast = event_connection::create_rpc_broadcast(method);
+		post_rpc_broadcast<T>(the_broadcast);
+	}
+	template <class T, class A> void broadcast_rpc(void (T::*method)(A), A arg1)
+	{
+		ref_ptr<event_connection::rpc_broadcast> the_broadcast = event_connection::create_rpc_broadcast(method, arg1);
+		post_rpc_broadcast<T>(the_broadcast);
+	}
+	template <class T, class A, class B> void broadcast_rpc(void (T::*method)(A,B), A arg1, B arg2)
+	{
+		ref_ptr<event_connection::rpc_broadcast> the_broadcast = event_connection::create_rpc_broadcast(method, arg1, arg2);
+		post_rpc_broadcast<T>(the_broadcast);
+	}
+
+	/// Posts a previously created broadcast to every established connection of class T.
+	template <class T> void post_rpc_broadcast(typename T::rpc_broadcast *the_broadcast)
+	{
+		for(uint32 i = 0; i < _connection_table.size(); i++)
+		{
+			net_connection *the_connection = *_connection_table[i].value();
+			if(the_connection->get_connection_state() != net_connection::state_established)
+				continue;
+			T *dest = dynamic_cast<T *>(the_connection);
+			if(dest)
+				dest->post_rpc_broadcast(the_broadcast);
+		}
+	}
+
 	void _add_connection(ref_ptr<net_connection> &the_net_connection, torque_connection_id the_torque_connection)
 	{
 		the_net_connection->set_torque_connection(the_torque_connection);
 		_connection_table.insert(the_torque_connection, the_net_connection);
 	}
 	
+	/// Queues a connection that was disconnected from this side to be removed from the connection table, once nothing further up the stack can be using it.
+	void _queue_connection_removal(torque_connection_id the_torque_connection)
+	{
+		_pending_connection_removals.push_back(the_torque_connection);
+	}
+	
+	void _remove_pending_connections()
+	{
+		for(uint32 i = 0; i < _pending_connection_removals.size(); i++)
+		{
+			connection_pointer p = _connection_table.find(_pending_connection_removals[i]);
+			if(p)
+				p.remove();
+		}
+		_pending_connection_removals.clear();
+	}
+	
 	void _process_challenge_response(torque_socket_event *event)
 	{
 		bit_stream challenge_response(event->data, event->data_size);
@@ -307,6 +467,23 @@ public:
 			(*the_connection)->on_packet_notify(event->packet_sequence, event->delivered);
 	}
 	
+	/// Sorts deferred RPCs by method, and by arrival (their position in the array being dispatched) within each method.
+	static int compare_deferred_rpcs(const void *a, const void *b)
+	{
+		const deferred_rpc *rpc_a = *((const deferred_rpc **) a);
+		const deferred_rpc *rpc_b = *((const deferred_rpc **) b);
+		if(rpc_a->method_hash != rpc_b->method_hash)
+			return rpc_a->method_hash < rpc_b->method_hash ? -1 : 1;
+		return rpc_a < rpc_b ? -1 : (rpc_a > rpc_b ? 1 : 0);
+	}
+	
+	void _dispatch_deferred_rpc(deferred_rpc &entry)
+	{
+		event_connection *the_connection = static_cast<event_connection *>((net_connection *) entry.connection);
+		if(the_connection->get_connection_state() == net_connection::state_established)
+			the_connection->dispatch_rpc(entry.rpc, entry.rpc_index, entry.target);
+	}
+	
 	virtual void _process_socket_packet(torque_socket_event *event)
 	{
 		
@@ -337,6 +514,11 @@ public:
 	{
 		collapse_dirty_list();
 		_dirty_list_head._next_dirty_list = 0;
+		
+		// objects may outlive the interface, so they must not return their ids to it
+		for(uint32 i = 0; i < _registered_objects.size(); i++)
+			if(_registered_objects[i])
+				_registered_objects[i]->_interface = NULL;
 	}
 	
 	torque_socket_handle &get_socket()
@@ -360,14 +542,30 @@ public:
 		_dirty_list_tail._prev_dirty_list = &_dirty_list_head;
 		_dirty_list_head._prev_dirty_list = 0;
 		_dirty_list_tail._next_dirty_list = 0;
+		_defer_rpc_dispatch = false;
+		_update_tick = 1;
 	}
 protected:
+	/// Returns the id of a destroyed object for reuse.
+	void free_object_id(uint32 object_id)
+	{
+		_registered_objects[object_id] = NULL;
+		_free_object_ids.push_back(object_id);
+	}
+	
+
 	torque_socket_interface *_ts_interface;
 	torque_socket_handle _socket;
 	net::time _process_start_time;
+	uint32 _update_tick; ///< Incremented by check_for_packet_sends(); never 0, so that 0 can mark a ghost_update_cache invalid.
+	array<net_object *> _registered_objects; ///< Objects registered with register_object(), by object id, or NULL for free ids.
+	array<uint32> _free_object_ids; ///< Ids of destroyed objects, to be reused.
 	net_object _dirty_list_head;
 	net_object _dirty_list_tail;	
 	array<connection_type_record> _connection_class_table;
 	hash_table_array<torque_connection_id, ref_ptr<net_connection> > _connection_table;
+	bool _defer_rpc_dispatch; ///< true if received RPCs are queued for dispatch_deferred_rpcs()
+	array<deferred_rpc> _deferred_rpcs; ///< RPCs waiting for dispatch_deferred_rpcs(), in the order they were received
+	array<torque_connection_id> _pending_connection_removals; ///< connections closed with net_connection::disconnect() that are still in _connection_table
 };
 
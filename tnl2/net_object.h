@@ -13,7 +13,7 @@
 ///
 /// @section NetObject_Implementation An Example Implementation
 ///
-/// The basis of the ghost implementation in TNL is net_object.  Each net_object maintains an <b>update_mask</b>, a 32 bit word representing up to 32 independent states for the ref_object.  When a net_object's state changes it calls the set_mask_bits method to notify the network layer that the state has changed and needs to be updated on all clients that have that net_object in scope.
+/// The basis of the ghost implementation in TNL is net_object.  Each net_object maintains an <b>update_mask</b>, a net_state_mask representing up to 64 independent states for the ref_object.  When a net_object's state changes it calls the set_mask_bits method to notify the network layer that the state has changed and needs to be updated on all clients that have that net_object in scope.
 ///
 /// Using a net_object is very simple; let's go through a simple example implementation:
 ///
@@ -36,7 +36,7 @@
 ///    };
 /// @endcode
 ///
-/// The example class has two ref_object "states" that each instance keeps track of, message1 and message2.  A real game ref_object might have states for health, velocity and position, or some other set of fields.  Each class has 32 bits to work with, so it's possible to be very specific when defining states.  In general, individual state bits should be assigned only to things that are updated independently - so if you update the position field and the velocity at the same time always, you could use a single bit to represent that state change.
+/// The example class has two ref_object "states" that each instance keeps track of, message1 and message2.  A real game ref_object might have states for health, velocity and position, or some other set of fields.  Each class has 64 bits to work with, and only as many bits of the mask as the class has states are sent with an update, so it's possible to be very specific when defining states.  In general, individual state bits should be assigned only to things that are updated independently - so if you update the position field and the velocity at the same time always, you could use a single bit to represent that state change.
 ///
 /// @code
 ///    SimpleNetObject()
@@ -68,7 +68,7 @@
 ///    }
 /// @endcode
 ///
-/// Here's half of the meat of the networking code, the pack_update() function. (The other half, unpack_update(), is shown below.) The comments in the code pretty much explain everything, however, notice that the code follows a pattern of if(writeFlag(mask & StateMask)) { ... write data ... }. The pack_update()/unpack_update() functions are responsible for reading and writing the update flags to the BitStream.  This means the ghost_connection doesn't have to send the 32 bit update_mask with every packet.
+/// Here's half of the meat of the networking code, the pack_update() function. (The other half, unpack_update(), is shown below.) The comments in the code pretty much explain everything, however, notice that the code follows a pattern of if(writeFlag(mask & StateMask)) { ... write data ... }. The pack_update()/unpack_update() functions are responsible for reading and writing the update flags to the BitStream.  This means the ghost_connection doesn't have to send the update_mask with every packet.
 ///
 /// @code
 ///    void unpack_update(ghost_connection *, bit_stream &stream)
@@ -115,20 +115,57 @@
 struct ghost_info;
 class ghost_connection;
 class net_interface;
+class spatial_index;
+class replication_node;
+
+/// A mask of the states of a net_object, with bit i set for state index i.
+typedef uint64 net_state_mask;
+
+enum {
+	max_net_states = 64, ///< Maximum number of states in a net_object class and its parents.
+};
+
+/// ghost_update_cache holds the encoded state updates of a net_object for the current update tick of its net_interface, so that every connection sending the object the same update mask copies one encoding instead of serializing the object's fields again.
+struct ghost_update_cache
+{
+	enum {
+		entry_count = 4, ///< Number of distinct update masks cached per object per tick.
+		initial_buffer_size = 64, ///< Bytes first allocated for an entry's encoding; the buffer doubles when an update doesn't fit.
+	};
+	struct entry
+	{
+		net_state_mask update_mask; ///< mask of the states encoded in bits
+		net_state_mask returned_mask; ///< states the field writers asked to resend
+		type_database::type_rep *type_rep; ///< type the update was encoded with
+		uint32 bit_count; ///< number of valid bits in bits
+		bool in_use; ///< true if bits holds an update encoded this tick
+		array<uint8> bits; ///< the encoded update; kept between ticks so updates are encoded in place once it is big enough
+	};
+	uint32 tick; ///< net_interface update tick the entries were encoded in, or 0 if they are invalid
+	uint32 next_entry; ///< entry to replace when all are in use
+	entry entries[entry_count];
+};
 
 class net_object : public ref_object
 {
 	friend class ghost_connection;
 	friend class net_interface;
+	friend class spatial_index;
 	
 	typedef ref_object parent;
 	
-	uint32 _dirty_mask_bits;
+	net_state_mask _dirty_mask_bits;
 	uint32 _remote_index; ///< The index of this ghost on the other side of the connection.
 	ghost_info *_first_object_ref; ///< Head of the linked list of GhostInfos for this ref_object.
 	
 	ghost_connection *_owning_connection; ///< The connection that owns this ghost, if it's a ghost
 	net_interface *_interface; ///< The net_interface this object is visible to -- a limitation of the ghosting system is that any one net_object can only be ghosted over connections within a single interface.
+	uint32 _object_id; ///< Compact id of this object among the objects of _interface, assigned when _interface is set.  Connections index their ghost_infos by it, so it is kept if the interface is destroyed first.
+	spatial_index *_spatial_index; ///< The spatial_index this object is in, if any.
+	int32 _spatial_index_entry; ///< Index of this object's entry in _spatial_index.
+	ghost_update_cache *_update_cache; ///< Encoded updates shared by the connections ghosting this object, allocated when it is first ghosted on more than one connection.
+	float32 _priority_x, _priority_y; ///< Position set with set_priority_position().
+	bool _has_priority_position; ///< True if connections prioritize this object by distance rather than by get_update_priority().
 	
 protected:
 	enum
@@ -146,6 +183,12 @@ public:
 		_remote_index = uint32(-1);
 		_first_object_ref = NULL;
 		_interface = NULL;
+		_object_id = 0;
+		_spatial_index = NULL;
+		_spatial_index_entry = 0;
+		_update_cache = NULL;
+		_priority_x = _priority_y = 0;
+		_has_priority_position = false;
 		_prev_dirty_list = NULL;
 		_next_dirty_list = NULL;
 		_dirty_mask_bits = 0;
@@ -160,6 +203,12 @@ public:
 	{
 		while(_first_object_ref)
 			_first_object_ref->connection->detach_object(_first_object_ref);
+		if(_interface)
+			_interface->free_object_id(_object_id);
+		
+		if(_spatial_index)
+			_spatial_index->remove_object(this);
+		delete _update_cache;
 		
 		if(_next_dirty_list)
 		{
@@ -186,11 +235,14 @@ public:
 	/// been changed.
 	///
 	/// @note This is a server side call. It has no meaning for ghosts.
-	void set_mask_bits(uint32 or_mask)
+	void set_mask_bits(net_state_mask or_mask)
 	{
 		if(is_ghost())
 			return;
 		assert(or_mask != 0);
+		// the state has changed, so updates encoded earlier this tick are stale
+		if(_update_cache)
+			_update_cache->tick = 0;
 		//Assert(_dirty_mask_bits == 0 || (_prev_dirty_list != NULL || _next_dirty_list != NULL || _dirty_list == this), "Invalid dirty list state.");
 		if(_interface)
 		{
@@ -203,17 +255,31 @@ public:
 	
 	void set_dirty_state(uint32 state_index)
 	{
-		set_mask_bits(1 << state_index);
+		set_mask_bits(net_state_mask(1) << state_index);
 	}
 	
 	/// Called to determine the relative update priority of an ref_object.
 	///
 	/// All objects that are in scope and that have out of date states are queried and sorted by priority before being updated.  If there is not enough room in a single packet for all out of date objects, the skipped objects will have an incremented update_skips the next time that connection prepares to send a packet. Typically the update priority is scaled by update_skips so that as data becomes stale, it becomes more of a priority to  update.
-	virtual float32 get_update_priority(net_object *scope_object, uint32 update_mask, uint32 update_skips)
+	virtual float32 get_update_priority(net_object *scope_object, net_state_mask update_mask, uint32 update_skips)
 	{
 		return float32(update_skips) * 0.1f;
 	}
 	
+	/// Opts this object into distance prioritization, or moves it.  Connections prioritize objects with a priority position in one batch by their distance from the scope object and their update_skips, as described in ghost_connection::compute_distance_priorities(), and don't call get_update_priority() on them.  Objects that use it should call this whenever they move.
+	void set_priority_position(float32 x, float32 y)
+	{
+		_priority_x = x;
+		_priority_y = y;
+		_has_priority_position = true;
+	}
+	
+	/// Returns this object to prioritization by get_update_priority().
+	void clear_priority_position()
+	{
+		_has_priority_position = false;
+	}
+	
 	/// For a scope ref_object, determine what is in scope.
 	///
 	/// perform_scope_query is called on a NetConnection's scope ref_object
@@ -223,12 +289,41 @@ public:
 	{
 	}
 	
+	/// For a scope ref_object, returns its position in x and y, for ghost_connection::set_scope_query_movement_threshold().  Returns false if the object has no position, which is the default.
+	virtual bool get_scope_position(float32 &x, float32 &y)
+	{
+		return false;
+	}
+	
 	/// on_ghost_update is called on the ghost when a portion of its states have been updated from the host.  For the initial update this will be called after on_ghost_add
-	virtual void on_ghost_update(uint32 mask_bits)
+	virtual void on_ghost_update(net_state_mask mask_bits)
 	{
 
 	}
 
+	/// Calls method on every ghost of this object that is currently available on a client.  The call is serialized once and shared by all of the connections; the ghost index of the target is resolved as each packet is written, and the call is dropped on connections where the ghost has gone out of scope by then.  The method must be registered with event_connection::register_object_rpc() on the connections.
+	template <class T> void ghost_rpc(void (T::*method)())
+	{
+		if(!_first_object_ref)
+			return;
+		ref_ptr<event_connection::rpc_broadcast> the_broadcast = event_connection::create_rpc_broadcast(method);
+		ghost_connection::post_ghost_rpc(this, the_broadcast);
+	}
+	template <class T, class A> void ghost_rpc(void (T::*method)(A), A arg1)
+	{
+		if(!_first_object_ref)
+			return;
+		ref_ptr<event_connection::rpc_broadcast> the_broadcast = event_connection::create_rpc_broadcast(method, arg1);
+		ghost_connection::post_ghost_rpc(this, the_broadcast);
+	}
+	template <class T, class A, class B> void ghost_rpc(void (T::*method)(A,B), A arg1, B arg2)
+	{
+		if(!_first_object_ref)
+			return;
+		ref_ptr<event_connection::rpc_broadcast> the_broadcast = event_connection::create_rpc_broadcast(method, arg1, arg2);
+		ghost_connection::post_ghost_rpc(this, the_broadcast);
+	}
+	
 	/// get_net_index returns the index tag used to identify the server copy
 	/// of a client ref_object.
 	uint32 get_net_index() { return _remote_index; }
@@ -0,0 +1,359 @@
+/// replication_graph shares scope work between connections that see many of the same objects.
+///
+/// Rather than each scope object finding its objects from scratch in perform_scope_query(), objects are organized into replication_nodes: lists of always-relevant objects, spatial grid cells, team or owner groups, and per-connection extras.  A connection's scope is the union of the graph's global nodes and the nodes in its replication_view.  Connections don't scope the objects of a node one by one: each connection remembers which nodes its last query included, and each node keeps a log of the objects added to and removed from it, so a query only visits the objects of nodes that are newly included, dropped, or changed since the connection's last query.  The per-connection cost of scoping a node that hasn't changed is the same however many objects it has.  Nodes that compute their object list, by overriding replication_node::gather_objects(), do so at most once per tick no matter how many connections include them.
+///
+/// @code
+///    // once, on the server
+///    _always_relevant = new replication_list_node;
+///    _graph.add_global_node(_always_relevant);
+///    _graph.add_global_node(new replication_grid_node(&_object_index));
+///
+///    // for each team
+///    _team_node[i] = new replication_list_node;
+///
+///    // in the scope object
+///    void perform_scope_query(ghost_connection *connection)
+///    {
+///       _view.x = _x;
+///       _view.y = _y;
+///       _game->_graph.scope(connection, _view);
+///    }
+/// @endcode
+///
+/// Call begin_tick() once per simulation tick, before connections send packets, so that gathered nodes are refreshed.
+
+class replication_node;
+class replication_graph;
+class replication_grid_node;
+
+/// replication_view describes what one connection sees: the position and radius used by spatial nodes, and the nodes, like team groups and extras, that it includes in addition to the graph's global nodes.
+struct replication_view
+{
+	float32 x, y; ///< Position of the viewer, for spatial nodes.
+	float32 radius; ///< Radius around the viewer that spatial nodes scope.
+	array<ref_ptr<replication_node> > nodes; ///< Nodes scoped for this connection only.
+
+	replication_view()
+	{
+		x = y = 0;
+		radius = 0.25f;
+	}
+
+	void add_node(replication_node *node)
+	{
+		nodes.push_back(node);
+	}
+
+	void remove_node(replication_node *node)
+	{
+		for(uint32 i = 0; i < nodes.size(); i++)
+		{
+			if(nodes[i] == node)
+			{
+				nodes.erase_unstable(i);
+				return;
+			}
+		}
+	}
+};
+
+/// replication_node is a set of objects that are in scope together.  Subclasses change the set with add_node_object() and remove_node_object(), either as objects come and go or from gather_objects(), which is called at most once per graph tick.  Every change is logged, so that connections that include the node can follow it without visiting its other objects.
+class replication_node : public ref_object
+{
+	friend class replication_graph;
+	friend class ghost_connection;
+public:
+	enum {
+		min_change_log_size = 64, ///< The change log is trimmed once it holds twice this many changes, or twice the number of objects if that is more.
+	};
+
+	replication_node()
+	{
+		_gathered_tick = 0;
+		_version = 0;
+		node_ids &ids = get_node_ids();
+		if(ids.free_ids.size())
+		{
+			_node_id = ids.free_ids[ids.free_ids.size() - 1];
+			ids.free_ids.pop_back();
+		}
+		else
+			_node_id = ids.next_id++;
+	}
+
+	~replication_node()
+	{
+		get_node_ids().free_ids.push_back(_node_id);
+	}
+
+	/// Scopes the node for connection.  The default includes all of the node's objects with ghost_connection::scope_node().  Subclasses may instead include other nodes, or call object_in_scope() on the objects visible to view.
+	virtual void scope(ghost_connection *connection, replication_view &view)
+	{
+		connection->scope_node(this);
+	}
+
+	/// Returns the objects in the node.  Objects that have been deleted are NULL until the node compacts its list.
+	array<safe_ptr<net_object> > &get_objects() { return _objects; }
+protected:
+	/// Updates the node's objects.  This is called at most once per graph tick, the first time a connection that includes the node is scoped.  The default leaves the objects as they are.
+	virtual void gather_objects()
+	{
+	}
+
+	void add_node_object(net_object *object)
+	{
+		_objects.push_back(object);
+		log_change(object, true);
+	}
+
+	/// Removes the object at index of the node's objects.  The last object takes its place.
+	void remove_node_object(uint32 index)
+	{
+		log_change(_objects[index], false);
+		_objects.erase_unstable(index);
+	}
+
+	/// Drops the entries of objects that have been deleted.  Their ghosts are gone already, so this isn't a change connections need to follow.
+	void compact_objects()
+	{
+		for(uint32 i = 0; i < _objects.size(); )
+		{
+			if(_objects[i])
+				i++;
+			else
+				_objects.erase_unstable(i);
+		}
+	}
+
+	array<safe_ptr<net_object> > _objects; ///< The objects in this node.
+private:
+	/// One addition or removal of an object.
+	struct node_change
+	{
+		safe_ptr<net_object> object; ///< the object, or NULL if it has since been deleted
+		bool added;
+	};
+
+	/// Allocator of node ids, which connections index their per-node scope by.
+	struct node_ids
+	{
+		array<uint32> free_ids;
+		uint32 next_id;
+		node_ids() { next_id = 0; }
+	};
+
+	static node_ids &get_node_ids()
+	{
+		static node_ids the_ids;
+		return the_ids;
+	}
+
+	void log_change(net_object *object, bool added)
+	{
+		_version++;
+		node_change change;
+		change.object = object;
+		change.added = added;
+		_changes.push_back(change);
+
+		// connections that fall further behind than the log reaches recount their node scopes
+		uint32 limit = max(uint32(min_change_log_size), _objects.size()) * 2;
+		if(_changes.size() < limit)
+			return;
+		uint32 drop = _changes.size() / 2;
+		for(uint32 i = drop; i < _changes.size(); i++)
+			_changes[i - drop] = _changes[i];
+		for(uint32 i = 0; i < drop; i++)
+			_changes.pop_back();
+	}
+
+	/// Gathers the node's objects if they haven't been gathered during tick yet.
+	void prepare(uint32 tick)
+	{
+		if(_gathered_tick == tick)
+			return;
+		_gathered_tick = tick;
+		gather_objects();
+	}
+
+	uint32 _gathered_tick; ///< Graph tick the objects were last gathered for.
+	uint32 _version; ///< Number of changes made to the node's objects.
+	array<node_change> _changes; ///< The most recent changes, the last of which brought the node to _version.
+	uint32 _node_id; ///< Compact id of this node among all live nodes.
+};
+
+/// replication_list_node is an explicitly managed list of objects, for always-relevant objects, team or owner groups, and per-connection extras.
+class replication_list_node : public replication_node
+{
+public:
+	void add_object(net_object *object)
+	{
+		add_node_object(object);
+	}
+
+	void remove_object(net_object *object)
+	{
+		for(uint32 i = 0; i < _objects.size(); i++)
+		{
+			if(_objects[i] == object)
+			{
+				remove_node_object(i);
+				return;
+			}
+		}
+	}
+
+	void clear()
+	{
+		while(_objects.size())
+			remove_node_object(_objects.size() - 1);
+	}
+protected:
+	void gather_objects()
+	{
+		compact_objects();
+	}
+};
+
+/// replication_cell_node holds the objects in one cell of the spatial_index of a replication_grid_node.
+class replication_cell_node : public replication_node
+{
+	friend class replication_grid_node;
+public:
+	int32 get_cell_x() { return _cell_x; }
+	int32 get_cell_y() { return _cell_y; }
+private:
+	replication_cell_node(int32 cell_x, int32 cell_y)
+	{
+		_cell_x = cell_x;
+		_cell_y = cell_y;
+	}
+
+	void remove_object(net_object *object)
+	{
+		for(uint32 i = 0; i < _objects.size(); i++)
+		{
+			if(_objects[i] == object)
+			{
+				remove_node_object(i);
+				return;
+			}
+		}
+	}
+
+	int32 _cell_x, _cell_y; ///< The grid cell of the node.
+};
+
+/// replication_grid_node scopes the cells of a spatial_index that are within the view radius of each connection.  It keeps a replication_cell_node for each occupied cell, maintained from the index as objects move between cells, so every connection whose view covers a cell shares the cell's object list, and a connection is only told about the objects that entered or left its cells since its last query.  Scope is by whole cells: objects in a cell that overlaps the view radius are in scope, so the index's cell size should be small next to typical view radii.  The spatial_index must outlive the node.
+class replication_grid_node : public replication_node, public spatial_index_listener
+{
+public:
+	replication_grid_node(spatial_index *index)
+	{
+		_index = index;
+		index->set_listener(this);
+	}
+
+	~replication_grid_node()
+	{
+		if(_index->get_listener() == this)
+			_index->set_listener(NULL);
+	}
+
+	void scope(ghost_connection *connection, replication_view &view)
+	{
+		int32 min_x = _index->get_cell(view.x - view.radius), max_x = _index->get_cell(view.x + view.radius);
+		int32 min_y = _index->get_cell(view.y - view.radius), max_y = _index->get_cell(view.y + view.radius);
+		for(int32 cell_y = min_y; cell_y <= max_y; cell_y++)
+		{
+			for(int32 cell_x = min_x; cell_x <= max_x; cell_x++)
+			{
+				replication_cell_node *cell = find_cell_node(cell_x, cell_y);
+				if(cell)
+					connection->scope_node(cell);
+			}
+		}
+	}
+
+	void on_cell_enter(net_object *object, int32 cell_x, int32 cell_y)
+	{
+		replication_cell_node *cell = find_cell_node(cell_x, cell_y);
+		if(!cell)
+		{
+			cell = new replication_cell_node(cell_x, cell_y);
+			_cells[spatial_index::hash_cell(cell_x, cell_y)].push_back(cell);
+		}
+		cell->add_node_object(object);
+	}
+
+	void on_cell_leave(net_object *object, int32 cell_x, int32 cell_y)
+	{
+		replication_cell_node *cell = find_cell_node(cell_x, cell_y);
+		if(cell)
+			cell->remove_object(object);
+	}
+private:
+	replication_cell_node *find_cell_node(int32 cell_x, int32 cell_y)
+	{
+		array<ref_ptr<replication_cell_node> > &bucket = _cells[spatial_index::hash_cell(cell_x, cell_y)];
+		for(uint32 i = 0; i < bucket.size(); i++)
+			if(bucket[i]->_cell_x == cell_x && bucket[i]->_cell_y == cell_y)
+				return bucket[i];
+		return NULL;
+	}
+
+	spatial_index *_index; ///< The index this node scopes from.
+	array<ref_ptr<replication_cell_node> > _cells[spatial_index::bucket_count]; ///< Cell nodes, hashed like the index's cells.  Cells are kept once created, so connections following them aren't disturbed when they empty.
+};
+
+/// replication_graph holds the nodes that are in scope for every connection, and scopes connections from their replication_views.
+class replication_graph
+{
+public:
+	replication_graph()
+	{
+		_tick = 1;
+	}
+
+	/// Adds a node that is scoped for every connection.
+	void add_global_node(replication_node *node)
+	{
+		_global_nodes.push_back(node);
+	}
+
+	void remove_global_node(replication_node *node)
+	{
+		for(uint32 i = 0; i < _global_nodes.size(); i++)
+		{
+			if(_global_nodes[i] == node)
+			{
+				_global_nodes.erase_unstable(i);
+				return;
+			}
+		}
+	}
+
+	/// Starts a new tick, so that each node gathers its objects again the next time it is scoped.
+	void begin_tick()
+	{
+		_tick++;
+	}
+
+	/// Scopes the global nodes and the nodes in view for connection.  Call this from the scope object's perform_scope_query(); when the query is over, the connection takes the objects of nodes that it included last query but not this one out of scope.
+	void scope(ghost_connection *connection, replication_view &view)
+	{
+		for(uint32 i = 0; i < _global_nodes.size(); i++)
+			scope_node(_global_nodes[i], connection, view);
+		for(uint32 i = 0; i < view.nodes.size(); i++)
+			scope_node(view.nodes[i], connection, view);
+	}
+private:
+	void scope_node(replication_node *node, ghost_connection *connection, replication_view &view)
+	{
+		node->prepare(_tick);
+		node->scope(connection, view);
+	}
+
+	array<ref_ptr<replication_node> > _global_nodes; ///< Nodes scoped for every connection.
+	uint32 _tick; ///< Current tick, for deciding which nodes need to gather their objects.
+};
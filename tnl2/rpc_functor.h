@@ -0,0 +1,206 @@
+/// rpc_functor is the argument storage and serialization for a single call of a method registered with event_connection::register_rpc.
+///
+/// Each argument type is written and read through rpc_arg_traits, which is resolved at compile time.  Types with a known bit width (bools, fixed size integers, float32, unit_float<N> and enumeration<N>) are packed directly into the bit_stream, net_strings go through the connection's string table, and any other type falls back to the generic core::write/core::read path.  When every argument of a signature has a known width, rpc_functor_decl<signature>::fixed_bit_size is the exact number of bits its arguments take on the wire, so the event_connection can check packet space before serializing the call.
+
+/// static_bit_count<count>::value is the number of bits needed to represent the values 0 through count - 1, computed at compile time.
+template <uint32 count, typename dummy = void> struct static_bit_count
+{
+	enum { value = 1 + static_bit_count<(count + 1) / 2>::value };
+};
+
+template <typename dummy> struct static_bit_count<1, dummy>
+{
+	enum { value = 0 };
+};
+
+template <typename dummy> struct static_bit_count<0, dummy>
+{
+	enum { value = 0 };
+};
+
+/// rpc_arg_traits describes how an RPC argument of type T is packed.  is_fixed_size is true when the argument always takes fixed_bit_size bits.
+template <typename T, typename dummy = void> struct rpc_arg_traits
+{
+	enum {
+		is_fixed_size = false,
+		fixed_bit_size = 0,
+	};
+	static void write(bit_stream &stream, const T &value, connection_string_table *strings) { core::write(stream, value); }
+	static void read(bit_stream &stream, T &value, connection_string_table *strings) { core::read(stream, value); }
+};
+
+template <typename dummy> struct rpc_arg_traits<bool, dummy>
+{
+	enum {
+		is_fixed_size = true,
+		fixed_bit_size = 1,
+	};
+	static void write(bit_stream &stream, const bool &value, connection_string_table *strings) { stream.write_bool(value); }
+	static void read(bit_stream &stream, bool &value, connection_string_table *strings) { value = stream.read_bool(); }
+};
+
+/// rpc_integer_arg_traits packs integer types of bit_count bits, sign extending on read.
+template <typename T, uint32 bit_count> struct rpc_integer_arg_traits
+{
+	enum {
+		is_fixed_size = true,
+		fixed_bit_size = bit_count,
+	};
+	static void write(bit_stream &stream, const T &value, connection_string_table *strings) { stream.write_integer(uint32(value), bit_count); }
+	static void read(bit_stream &stream, T &value, connection_string_table *strings) { value = T(stream.read_integer(bit_count)); }
+};
+
+template <typename dummy> struct rpc_arg_traits<uint8, dummy> : rpc_integer_arg_traits<uint8, 8> {};
+template <typename dummy> struct rpc_arg_traits<int8, dummy> : rpc_integer_arg_traits<int8, 8> {};
+template <typename dummy> struct rpc_arg_traits<uint16, dummy> : rpc_integer_arg_traits<uint16, 16> {};
+template <typename dummy> struct rpc_arg_traits<int16, dummy> : rpc_integer_arg_traits<int16, 16> {};
+template <typename dummy> struct rpc_arg_traits<uint32, dummy> : rpc_integer_arg_traits<uint32, 32> {};
+template <typename dummy> struct rpc_arg_traits<int32, dummy> : rpc_integer_arg_traits<int32, 32> {};
+
+template <typename dummy> struct rpc_arg_traits<float32, dummy>
+{
+	enum {
+		is_fixed_size = true,
+		fixed_bit_size = 32,
+	};
+	union float_bits {
+		float32 f;
+		uint32 i;
+	};
+	static void write(bit_stream &stream, const float32 &value, connection_string_table *strings)
+	{
+		float_bits bits;
+		bits.f = value;
+		stream.write_integer(bits.i, 32);
+	}
+	static void read(bit_stream &stream, float32 &value, connection_string_table *strings)
+	{
+		float_bits bits;
+		bits.i = stream.read_integer(32);
+		value = bits.f;
+	}
+};
+
+/// unit_float<bit_count> values are quantized to bit_count bits across the range [0, 1].
+template <uint32 bit_count, typename dummy> struct rpc_arg_traits<unit_float<bit_count>, dummy>
+{
+	enum {
+		is_fixed_size = true,
+		fixed_bit_size = bit_count,
+		max_value = (1 << bit_count) - 1,
+	};
+	static void write(bit_stream &stream, const unit_float<bit_count> &value, connection_string_table *strings)
+	{
+		float32 f = float32(value);
+		f = f < 0 ? 0 : (f > 1 ? 1 : f);
+		stream.write_integer(uint32(f * max_value + 0.5f), bit_count);
+	}
+	static void read(bit_stream &stream, unit_float<bit_count> &value, connection_string_table *strings)
+	{
+		value = float32(stream.read_integer(bit_count)) / float32(max_value);
+	}
+};
+
+/// enumeration<count> values are written with just enough bits to hold count - 1.
+template <uint32 count, typename dummy> struct rpc_arg_traits<enumeration<count>, dummy>
+{
+	enum {
+		is_fixed_size = true,
+		fixed_bit_size = static_bit_count<count>::value,
+	};
+	static void write(bit_stream &stream, const enumeration<count> &value, connection_string_table *strings) { stream.write_integer(uint32(value), fixed_bit_size); }
+	static void read(bit_stream &stream, enumeration<count> &value, connection_string_table *strings) { value = enumeration<count>(stream.read_integer(fixed_bit_size)); }
+};
+
+/// net_string arguments are sent through the connection's string table, or in full when there is none, as when a broadcast is serialized for many connections at once.
+template <typename dummy> struct rpc_arg_traits<net_string, dummy>
+{
+	enum {
+		is_fixed_size = false,
+		fixed_bit_size = 0,
+	};
+	static void write(bit_stream &stream, const net_string &value, connection_string_table *strings)
+	{
+		if(strings)
+			strings->write(stream, value);
+		else
+			net_string::write_text(stream, value);
+	}
+	static void read(bit_stream &stream, net_string &value, connection_string_table *strings) { strings->read(stream, value); }
+};
+
+/// rpc_functor is the base class for the stored arguments of a single RPC call.
+struct rpc_functor : public ref_object
+{
+	/// strings is the string table of the connection the call is written to or read from; it is NULL when a call is serialized once for many connections.
+	virtual void write(bit_stream &stream, connection_string_table *strings) = 0;
+	virtual void read(bit_stream &stream, connection_string_table *strings) = 0;
+	virtual void dispatch(void *object) = 0;
+};
+
+template <typename signature> struct rpc_functor_decl;
+
+template <class T> struct rpc_functor_decl<void (T::*)()> : rpc_functor
+{
+	typedef void (T::*method_pointer)();
+	typedef T object_type;
+	enum {
+		is_fixed_size = true,
+		fixed_bit_size = 0,
+	};
+	method_pointer _method;
+	rpc_functor_decl(method_pointer method) : _method(method) {}
+	void set() {}
+	void write(bit_stream &stream, connection_string_table *strings) {}
+	void read(bit_stream &stream, connection_string_table *strings) {}
+	void dispatch(void *object) { (((T *) object)->*_method)(); }
+};
+
+template <class T, class A> struct rpc_functor_decl<void (T::*)(A)> : rpc_functor
+{
+	typedef void (T::*method_pointer)(A);
+	typedef T object_type;
+	enum {
+		is_fixed_size = rpc_arg_traits<A>::is_fixed_size,
+		fixed_bit_size = rpc_arg_traits<A>::fixed_bit_size,
+	};
+	method_pointer _method;
+	A _a;
+	rpc_functor_decl(method_pointer method) : _method(method) {}
+	void set(const A &a) { _a = a; }
+	void write(bit_stream &stream, connection_string_table *strings) { rpc_arg_traits<A>::write(stream, _a, strings); }
+	void read(bit_stream &stream, connection_string_table *strings) { rpc_arg_traits<A>::read(stream, _a, strings); }
+	void dispatch(void *object) { (((T *) object)->*_method)(_a); }
+};
+
+template <class T, class A, class B> struct rpc_functor_decl<void (T::*)(A,B)> : rpc_functor
+{
+	typedef void (T::*method_pointer)(A,B);
+	typedef T object_type;
+	enum {
+		is_fixed_size = rpc_arg_traits<A>::is_fixed_size && rpc_arg_traits<B>::is_fixed_size,
+		fixed_bit_size = rpc_arg_traits<A>::fixed_bit_size + rpc_arg_traits<B>::fixed_bit_size,
+	};
+	method_pointer _method;
+	A _a;
+	B _b;
+	rpc_functor_decl(method_pointer method) : _method(method) {}
+	void set(const A &a, const B &b) { _a = a; _b = b; }
+	void write(bit_stream &stream, connection_string_table *strings) { rpc_arg_traits<A>::write(stream, _a, strings); rpc_arg_traits<B>::write(stream, _b, strings); }
+	void read(bit_stream &stream, connection_string_table *strings) { rpc_arg_traits<A>::read(stream, _a, strings); rpc_arg_traits<B>::read(stream, _b, strings); }
+	void dispatch(void *object) { (((T *) object)->*_method)(_a, _b); }
+};
+
+/// rpc_functor_creator constructs empty rpc_functors for a registered method, to read incoming calls into.
+struct rpc_functor_creator
+{
+	virtual ~rpc_functor_creator() {}
+	virtual rpc_functor *create() = 0;
+};
+
+template <typename signature> struct rpc_functor_creator_decl : rpc_functor_creator
+{
+	signature _method;
+	rpc_functor_creator_decl(signature method) : _method(method) {}
+	rpc_functor *create() { return new rpc_functor_decl<signature>(_method); }
+};
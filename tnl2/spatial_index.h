@@ -0,0 +1,229 @@
+/// spatial_index is a uniform grid of net_objects on a 2D plane, for scope queries that only visit the objects near the scope object rather than every object in the world.
+///
+/// Objects are added with add_object(), and must call update_object() whenever they move; an object only changes grid cells when it crosses a cell boundary, so updates are constant time.  The grid is unbounded: cells are hashed into a fixed number of buckets, so the world can be any size, but the cell_size should be on the order of the typical query radius so that a query visits only a few cells.  An object is removed from the index when it is destroyed.
+///
+/// scope_radius() and scope_box() call ghost_connection::object_in_scope() on every object in the query area, and are meant to be called from net_object::perform_scope_query():
+///
+/// @code
+///    void perform_scope_query(ghost_connection *connection)
+///    {
+///       _game->_object_index.scope_radius(connection, _x, _y, 0.25f);
+///    }
+/// @endcode
+///
+/// A spatial_index_listener set with set_listener() is told whenever an object enters or leaves a grid cell, which replication_grid_node uses to keep a replication_node per cell.
+
+/// spatial_index_listener receives the grid cell changes of the objects in a spatial_index.
+class spatial_index_listener
+{
+public:
+	virtual ~spatial_index_listener() {}
+	virtual void on_cell_enter(net_object *object, int32 cell_x, int32 cell_y) = 0;
+	virtual void on_cell_leave(net_object *object, int32 cell_x, int32 cell_y) = 0;
+};
+
+class spatial_index
+{
+public:
+	enum {
+		bucket_count_shift = 12,
+		bucket_count = (1 << bucket_count_shift), ///< Number of hash buckets the grid cells are spread over.
+		invalid_entry = -1,
+	};
+
+	spatial_index(float32 cell_size = 0.125f)
+	{
+		_cell_size = cell_size;
+		_inverse_cell_size = 1 / cell_size;
+		_free_entry = invalid_entry;
+		_listener = NULL;
+		for(uint32 i = 0; i < bucket_count; i++)
+			_buckets[i] = invalid_entry;
+	}
+
+	~spatial_index()
+	{
+		for(uint32 i = 0; i < _entries.size(); i++)
+			if(_entries[i].object)
+				_entries[i].object->_spatial_index = NULL;
+	}
+
+	/// Adds object to the index at (x, y).  An object can be in only one spatial_index at a time.
+	void add_object(net_object *object, float32 x, float32 y)
+	{
+		assert(object->_spatial_index == NULL);
+		int32 index = _free_entry;
+		if(index != invalid_entry)
+			_free_entry = _entries[index].next;
+		else
+		{
+			index = _entries.size();
+			_entries.resize(index + 1);
+		}
+		entry &the_entry = _entries[index];
+		the_entry.object = object;
+		the_entry.x = x;
+		the_entry.y = y;
+		the_entry.cell_x = get_cell(x);
+		the_entry.cell_y = get_cell(y);
+		link(index);
+
+		object->_spatial_index = this;
+		object->_spatial_index_entry = index;
+		if(_listener)
+			_listener->on_cell_enter(object, the_entry.cell_x, the_entry.cell_y);
+	}
+
+	/// Moves object to (x, y).  This is cheap when the object stays within the same grid cell.
+	void update_object(net_object *object, float32 x, float32 y)
+	{
+		assert(object->_spatial_index == this);
+		int32 index = object->_spatial_index_entry;
+		entry &the_entry = _entries[index];
+		the_entry.x = x;
+		the_entry.y = y;
+
+		int32 cell_x = get_cell(x);
+		int32 cell_y = get_cell(y);
+		if(cell_x == the_entry.cell_x && cell_y == the_entry.cell_y)
+			return;
+		unlink(index);
+		if(_listener)
+			_listener->on_cell_leave(object, the_entry.cell_x, the_entry.cell_y);
+		the_entry.cell_x = cell_x;
+		the_entry.cell_y = cell_y;
+		link(index);
+		if(_listener)
+			_listener->on_cell_enter(object, cell_x, cell_y);
+	}
+
+	/// Removes object from the index.  This is called automatically when the object is destroyed.
+	void remove_object(net_object *object)
+	{
+		assert(object->_spatial_index == this);
+		int32 index = object->_spatial_index_entry;
+		unlink(index);
+		if(_listener)
+			_listener->on_cell_leave(object, _entries[index].cell_x, _entries[index].cell_y);
+		_entries[index].object = NULL;
+		_entries[index].next = _free_entry;
+		_free_entry = index;
+
+		object->_spatial_index = NULL;
+	}
+
+	/// Calls object_in_scope() on connection for every object within radius of (x, y).
+	void scope_radius(ghost_connection *connection, float32 x, float32 y, float32 radius)
+	{
+		float32 radius_squared = radius * radius;
+		int32 min_x = get_cell(x - radius), max_x = get_cell(x + radius);
+		int32 min_y = get_cell(y - radius), max_y = get_cell(y + radius);
+
+		for(int32 cell_y = min_y; cell_y <= max_y; cell_y++)
+		{
+			for(int32 cell_x = min_x; cell_x <= max_x; cell_x++)
+			{
+				for(int32 walk = _buckets[hash_cell(cell_x, cell_y)]; walk != invalid_entry; walk = _entries[walk].next)
+				{
+					entry &the_entry = _entries[walk];
+					// other cells may share this bucket
+					if(the_entry.cell_x != cell_x || the_entry.cell_y != cell_y)
+						continue;
+					float32 dx = the_entry.x - x;
+					float32 dy = the_entry.y - y;
+					if(dx * dx + dy * dy < radius_squared)
+						connection->object_in_scope(the_entry.object);
+				}
+			}
+		}
+	}
+
+	/// Calls object_in_scope() on connection for every object in the box from (min_x, min_y) to (max_x, max_y).
+	void scope_box(ghost_connection *connection, float32 min_x, float32 min_y, float32 max_x, float32 max_y)
+	{
+		int32 min_cell_x = get_cell(min_x), max_cell_x = get_cell(max_x);
+		int32 min_cell_y = get_cell(min_y), max_cell_y = get_cell(max_y);
+
+		for(int32 cell_y = min_cell_y; cell_y <= max_cell_y; cell_y++)
+		{
+			for(int32 cell_x = min_cell_x; cell_x <= max_cell_x; cell_x++)
+			{
+				for(int32 walk = _buckets[hash_cell(cell_x, cell_y)]; walk != invalid_entry; walk = _entries[walk].next)
+				{
+					entry &the_entry = _entries[walk];
+					if(the_entry.cell_x != cell_x || the_entry.cell_y != cell_y)
+						continue;
+					if(the_entry.x >= min_x && the_entry.x <= max_x && the_entry.y >= min_y && the_entry.y <= max_y)
+						connection->object_in_scope(the_entry.object);
+				}
+			}
+		}
+	}
+
+	float32 get_cell_size() { return _cell_size; }
+
+	/// Sets the listener told about objects entering and leaving cells, or NULL for none.  The new listener is told about the cell of every object already in the index.
+	void set_listener(spatial_index_listener *listener)
+	{
+		_listener = listener;
+		if(!listener)
+			return;
+		for(uint32 i = 0; i < _entries.size(); i++)
+			if(_entries[i].object)
+				listener->on_cell_enter(_entries[i].object, _entries[i].cell_x, _entries[i].cell_y);
+	}
+
+	spatial_index_listener *get_listener() { return _listener; }
+
+	/// Returns the grid cell coordinate containing coordinate.
+	int32 get_cell(float32 coordinate)
+	{
+		float32 cell = coordinate * _inverse_cell_size;
+		int32 index = int32(cell);
+		// round toward negative infinity, so the cells either side of zero aren't merged
+		return (float32(index) > cell) ? index - 1 : index;
+	}
+
+	static uint32 hash_cell(int32 cell_x, int32 cell_y)
+	{
+		return (uint32(cell_x) * 73856093U ^ uint32(cell_y) * 19349663U) & (bucket_count - 1);
+	}
+private:
+	struct entry
+	{
+		net_object *object; ///< The indexed object, or NULL if this entry is free.
+		float32 x, y; ///< Position of the object.
+		int32 cell_x, cell_y; ///< Grid cell the object is in.
+		int32 prev; ///< Previous entry in the same bucket.
+		int32 next; ///< Next entry in the same bucket, or the next free entry.
+	};
+
+	void link(int32 index)
+	{
+		entry &the_entry = _entries[index];
+		int32 &bucket = _buckets[hash_cell(the_entry.cell_x, the_entry.cell_y)];
+		the_entry.prev = invalid_entry;
+		the_entry.next = bucket;
+		if(bucket != invalid_entry)
+			_entries[bucket].prev = index;
+		bucket = index;
+	}
+
+	void unlink(int32 index)
+	{
+		entry &the_entry = _entries[index];
+		if(the_entry.prev != invalid_entry)
+			_entries[the_entry.prev].next = the_entry.next;
+		else
+			_buckets[hash_cell(the_entry.cell_x, the_entry.cell_y)] = the_entry.next;
+		if(the_entry.next != invalid_entry)
+			_entries[the_entry.next].prev = the_entry.prev;
+	}
+
+	float32 _cell_size; ///< Width and height of a grid cell.
+	float32 _inverse_cell_size;
+	array<entry> _entries; ///< Entries for the indexed objects, with free entries chained through next.
+	int32 _free_entry; ///< First free entry in _entries, or invalid_entry.
+	int32 _buckets[bucket_count]; ///< Heads of the per-bucket entry lists.
+	spatial_index_listener *_listener; ///< Told about objects changing cells, if set.
+};
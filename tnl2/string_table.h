@@ -0,0 +1,299 @@
+/// net_string is an RPC argument type for strings that are likely to be sent over a connection many times, like player names, message keys and asset names.  On an event_connection the first send of a string transmits its text along with a short id, and once the remote host is known to have received it, later sends of the same string transmit only the id.
+struct net_string
+{
+	string value;
+
+	net_string() {}
+	net_string(const char *the_string) : value(the_string) {}
+	net_string(const string &the_string) : value(the_string) {}
+	const char *c_str() const { return value.c_str(); }
+
+	/// Writes the full text of the string, with no id, for streams that aren't sent on a connection with a connection_string_table.
+	static void write_text(bit_stream &stream, const net_string &the_string)
+	{
+		stream.write_bool(false);
+		stream.write_bool(false);
+		core::write(stream, the_string.value);
+	}
+};
+
+/// connection_string_table assigns the strings sent over a connection to a bounded table of ids, and tracks which of them the remote host has received.
+///
+/// A string is written as its id only once a packet carrying its full text is known to have been received; until then it is written in full along with its id, and the strings written in full in each packet are recorded in string_notes that the connection attaches to the packet's notify.  When the table is full, the least recently used entry is reassigned.  Each entry has a generation count, so that the ack of a packet carrying an entry's previous string doesn't mark its new string as received.  Packets are processed in order, so a reference to an id always resolves to the string the sender had assigned to it when the reference was written.
+class connection_string_table
+{
+public:
+	enum {
+		entry_count = 256, ///< Number of strings the table holds.
+		entry_id_bit_size = 8, ///< Size, in bits, of a string id on the wire.
+		invalid_entry = -1,
+	};
+	/// string_note records a string written in full in a packet.
+	struct string_note
+	{
+		uint32 id; ///< id the string was written with
+		uint32 generation; ///< generation of the entry when the string was written
+		string_note *next; ///< next string written in the same packet
+	};
+
+	connection_string_table()
+	{
+		for(uint32 i = 0; i < entry_count; i++)
+		{
+			_entries[i].in_use = false;
+			_entries[i].generation = 0;
+			_buckets[i] = invalid_entry;
+			_received_valid[i] = false;
+		}
+		_use_count = 0;
+		_sent_notes = NULL;
+	}
+
+	~connection_string_table()
+	{
+		free_notes(_sent_notes);
+	}
+
+	/// Writes a string, as its id if the remote host has it, or else in full.
+	void write(bit_stream &stream, const net_string &the_string)
+	{
+		const char *text = the_string.c_str();
+		uint32 hash = hash_string(text);
+		int32 id = find(text, hash);
+
+		if(id != invalid_entry && _entries[id].remote_has)
+		{
+			_entries[id].last_used = ++_use_count;
+			stream.write_bool(true);
+			stream.write_integer(id, entry_id_bit_size);
+			return;
+		}
+		if(id == invalid_entry)
+			id = assign(the_string, hash);
+		_entries[id].last_used = ++_use_count;
+
+		stream.write_bool(false);
+		stream.write_bool(true);
+		stream.write_integer(id, entry_id_bit_size);
+		core::write(stream, the_string.value);
+
+		string_note *note = new string_note;
+		note->id = id;
+		note->generation = _entries[id].generation;
+		note->next = _sent_notes;
+		_sent_notes = note;
+	}
+
+	/// Reads a string written by write() or net_string::write_text() on the remote host.
+	void read(bit_stream &stream, net_string &the_string)
+	{
+		if(stream.read_bool())
+		{
+			uint32 id = stream.read_integer(entry_id_bit_size);
+			if(!_received_valid[id])
+				throw tnl_exception_invalid_packet;
+			the_string.value = _received[id];
+			return;
+		}
+		bool has_id = stream.read_bool();
+		uint32 id = has_id ? stream.read_integer(entry_id_bit_size) : 0;
+		core::read(stream, the_string.value);
+		if(has_id)
+		{
+			_received[id] = the_string.value;
+			_received_valid[id] = true;
+		}
+	}
+
+	/// Returns a marker for the strings written so far, to pass to rewind_sent_notes() if the data they were written in is rewound out of the packet.
+	string_note *get_sent_mark()
+	{
+		return _sent_notes;
+	}
+
+	/// Forgets the strings written since get_sent_mark() returned mark.
+	void rewind_sent_notes(string_note *mark)
+	{
+		while(_sent_notes != mark)
+		{
+			string_note *next = _sent_notes->next;
+			delete _sent_notes;
+			_sent_notes = next;
+		}
+	}
+
+	/// Returns the list of strings written in full since the last call, to be attached to the packet they were written in.
+	string_note *take_sent_notes()
+	{
+		string_note *notes = _sent_notes;
+		_sent_notes = NULL;
+		return notes;
+	}
+
+	/// Marks the strings written in full in a received packet as known to the remote host, and frees the notes.
+	void packet_received(string_note *notes)
+	{
+		for(string_note *walk = notes; walk; walk = walk->next)
+		{
+			entry &the_entry = _entries[walk->id];
+			if(the_entry.in_use && the_entry.generation == walk->generation)
+				the_entry.remote_has = true;
+		}
+		free_notes(notes);
+	}
+
+	/// Frees the notes of a dropped packet; its strings will be written in full again the next time they are sent.
+	void packet_dropped(string_note *notes)
+	{
+		free_notes(notes);
+	}
+
+	/// FNV-1a hash of a string.
+	static uint32 hash_string(const char *text)
+	{
+		uint32 hash = 2166136261U;
+		for(; *text; text++)
+			hash = (hash ^ uint8(*text)) * 16777619U;
+		return hash;
+	}
+private:
+	struct entry
+	{
+		string text; ///< the string assigned to this id
+		uint32 hash; ///< hash_string() of the text
+		uint32 generation; ///< incremented each time the entry is assigned a new string
+		uint32 last_used; ///< value of _use_count when the entry was last written, for least recently used replacement
+		int32 next_in_bucket; ///< next entry in the same hash bucket, or invalid_entry
+		bool in_use; ///< true if a string is assigned to this id
+		bool remote_has; ///< true once a packet carrying the full text of this generation of the entry has been received
+	};
+
+	/// Returns the id of text, or invalid_entry if it isn't in the table.
+	int32 find(const char *text, uint32 hash)
+	{
+		for(int32 id = _buckets[hash & (entry_count - 1)]; id != invalid_entry; id = _entries[id].next_in_bucket)
+			if(_entries[id].hash == hash && !strcmp(_entries[id].text.c_str(), text))
+				return id;
+		return invalid_entry;
+	}
+
+	/// Assigns a string to a free entry, or to the least recently used entry if the table is full.
+	int32 assign(const net_string &the_string, uint32 hash)
+	{
+		int32 id = 0;
+		for(uint32 i = 0; i < entry_count; i++)
+		{
+			if(!_entries[i].in_use)
+			{
+				id = i;
+				break;
+			}
+			if(_entries[i].last_used < _entries[id].last_used)
+				id = i;
+		}
+		entry &the_entry = _entries[id];
+		if(the_entry.in_use)
+			unlink(id);
+
+		the_entry.text = the_string.value;
+		the_entry.hash = hash;
+		the_entry.generation++;
+		the_entry.in_use = true;
+		the_entry.remote_has = false;
+
+		int32 &bucket = _buckets[hash & (entry_count - 1)];
+		the_entry.next_in_bucket = bucket;
+		bucket = id;
+		return id;
+	}
+
+	/// Removes an entry from its hash bucket.
+	void unlink(int32 id)
+	{
+		int32 *walk = &_buckets[_entries[id].hash & (entry_count - 1)];
+		while(*walk != id)
+			walk = &_entries[*walk].next_in_bucket;
+		*walk = _entries[id].next_in_bucket;
+	}
+
+	static void free_notes(string_note *notes)
+	{
+		while(notes)
+		{
+			string_note *next = notes->next;
+			delete notes;
+			notes = next;
+		}
+	}
+
+	entry _entries[entry_count]; ///< Strings sent to the remote host, by id.
+	int32 _buckets[entry_count]; ///< Heads of the hash chains of _entries.
+	uint32 _use_count; ///< Incremented each time a string is written.
+	string_note *_sent_notes; ///< Strings written in full since take_sent_notes() was last called, newest first.
+
+	string _received[entry_count]; ///< Strings received from the remote host, by id.
+	bool _received_valid[entry_count]; ///< Whether each id has been received.
+};
+
+/// String slots are ghosted net_string fields that are written through the connection_string_table of each connection, so a string that is ghosted again and again, like a player's name on every client that sees them, is sent in full only until the remote host has it.
+///
+/// A string slot is registered for a field of a net_object class in place of a type_database slot, with the tnl_string_slot macro:
+///
+/// @code
+///    static void register_class(type_database &the_database)
+///    {
+///       tnl_begin_class(the_database, player, net_object, true);
+///       tnl_slot(the_database, player, _t, position_state);
+///       tnl_end_class(the_database);
+///       tnl_string_slot(player, _name, name_state);
+///    }
+/// @endcode
+///
+/// As with delta slots, the state_index must also be used by a type_database slot of the class.  An update that includes a string slot's state is encoded separately for each connection, since each has its own string table.
+struct string_slot
+{
+	uint32 offset; ///< offset of the net_string in the object
+	uint32 state_index; ///< state whose mask bit marks the string as changed
+};
+
+/// Global registry of string slots by class.
+class string_slot_registry
+{
+public:
+	/// Registers a string slot; registering the same field again is ignored.
+	void add(type_record *type, uint32 offset, uint32 state_index)
+	{
+		for(uint32 i = 0; i < _slots.size(); i++)
+			if(_slots[i].type == type && _slots[i].slot.offset == offset)
+				return;
+		class_slot s;
+		s.type = type;
+		s.slot.offset = offset;
+		s.slot.state_index = state_index;
+		_slots.push_back(s);
+	}
+
+	/// Appends the string slots registered for type, and no others, to slots.
+	void get_slots(type_record *type, array<string_slot> &slots)
+	{
+		for(uint32 i = 0; i < _slots.size(); i++)
+			if(_slots[i].type == type)
+				slots.push_back(_slots[i].slot);
+	}
+private:
+	struct class_slot
+	{
+		type_record *type;
+		string_slot slot;
+	};
+	array<class_slot> _slots; ///< every registered slot
+};
+
+static string_slot_registry &get_string_slot_registry()
+{
+	static string_slot_registry the_registry;
+	return the_registry;
+}
+
+/// Registers the net_string field of class_name, updated with state_index, as a string slot.
+#define tnl_string_slot(class_name, field, state_index) get_string_slot_registry().add(get_global_type_record<class_name>(), uint32(size_t(&(((class_name *) 0)->field))), state_index)
@@ -1,6 +1,12 @@
 #include "exceptions.h"
+#include "string_table.h"
+#include "rpc_functor.h"
 #include "net_object.h"
+#include "delta_slot.h"
+#include "field_table.h"
 #include "net_interface.h"
 #include "net_connection.h"
 #include "event_connection.h"
 #include "ghost_connection.h"
+#include "spatial_index.h"
+#include "replication_graph.h"